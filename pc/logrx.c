@@ -0,0 +1,196 @@
+/*
+ * File:   logrx.c
+ *
+ * PC end of the robot's log export (source/export.h). It reads the bus
+ * traffic for I2C address 0x08 on stdin, one transaction per line, and
+ * answers reads on stdout:
+ *
+ *   W <seconds> <hex bytes>      bytes the robot wrote
+ *   R <seconds> <count>          the robot reads, answered with hex bytes
+ *
+ * robot-sim --pc-cmd runs it on the simulated bus; a bridge to a real I2C
+ * slave only has to speak the same lines. Runs are written as CSV, and the
+ * transfer time and frame counts go to stderr when the input ends.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#define SOF             0xA5
+#define VERSION         3
+#define RECORD          40      //16 bytes of run data, then min, mean and max per phase
+#define PHASES          8
+#define MAX_RUNS        255
+#define MAX_FRAME       256
+#define READY           0x01
+
+static unsigned char header[5];     //version, runs, record size, runs per frame, newest run
+static int have_header, complete;
+static unsigned char next;          //Frame wanted next
+static unsigned char runs[MAX_RUNS + 1][RECORD];
+static double t_start, t_end;
+static unsigned long frames, bad_crc, out_of_order, resumed, bytes;
+static int stall_after = -1, stalled;
+static const char *csv_file;
+
+static const char *phase_names[PHASES] = {
+    "detect", "sense", "to_post", "post", "to_bottom", "servo", "tip", "return"
+};
+
+static unsigned char crc8(const unsigned char *p, int len){
+    unsigned char crc = 0xFF;
+    while (len--){
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++){
+            crc = (crc & 0x80) ? (unsigned char)((crc << 1) ^ 0x07) : (unsigned char)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static void write_csv(void){
+    FILE *f = csv_file ? fopen(csv_file, "w") : stderr;
+    if (!f){
+        perror(csv_file);
+        return;
+    }
+    fprintf(f, "run,date,time,seconds,yop_cap,yop_nocap,eska_cap,eska_nocap,bottles");
+    for (int p = 0; p < PHASES; p++){
+        fprintf(f, ",%s_min,%s_mean,%s_max", phase_names[p], phase_names[p], phase_names[p]);
+    }
+    fprintf(f, "\n");
+    for (int i = 1; i <= header[1]; i++){
+        const unsigned char *r = runs[i];
+        unsigned long ms = r[12] | (r[13] << 8) | ((unsigned long)r[14] << 16) | ((unsigned long)r[15] << 24);
+        fprintf(f, "%d,20%02u-%02u-%02u,%02u:%02u:%02u,%.2f,%u,%u,%u,%u,%u",
+                i, r[0], r[1], r[2], r[3], r[4], r[5], ms / 1000.0, r[7], r[8], r[9], r[10], r[11]);
+        //Phases are in 1/32 s
+        for (int p = 0; p < PHASES; p++){
+            fprintf(f, ",%.3f,%.3f,%.3f", r[16 + p] / 32.0, r[24 + p] / 32.0, r[32 + p] / 32.0);
+        }
+        fprintf(f, "\n");
+    }
+    if (f != stderr){
+        fclose(f);
+    }
+}
+
+static void frame(double t, const unsigned char *b, int n){
+    bytes += n;
+    if (stalled){
+        return;
+    }
+    if (n < 5 || b[0] != SOF || b[3] + 5 != n || crc8(b + 1, n - 2) != b[n - 1]){
+        bad_crc++;
+        return;
+    }
+    unsigned char type = b[1], seq = b[2];
+    const unsigned char *p = b + 4;
+    frames++;
+
+    if (type == 'H'){
+        if (b[3] != sizeof header || p[0] != VERSION || p[2] != RECORD){
+            fprintf(stderr, "logrx: unsupported export version %u\n", p[0]);
+            return;
+        }
+        //Same run count and newest run: the same log as the interrupted
+        //transfer, carry on. Once the ring is full only the newest run
+        //tells a log that gained runs since apart.
+        if (have_header && !complete && next > 1 && memcmp(header, p, sizeof header) == 0){
+            resumed++;
+        } else {
+            memcpy(header, p, sizeof header);
+            memset(runs, 0, sizeof runs);
+            have_header = 1;
+            complete = 0;
+            next = 1;
+            t_start = t;
+        }
+        return;
+    }
+    if (!have_header || seq != next){
+        out_of_order++;
+        return;
+    }
+    if (type == 'R'){
+        int run = p[0];
+        for (int i = 1; i + RECORD <= b[3] && run <= header[1]; i += RECORD, run++){
+            memcpy(runs[run], p + i, RECORD);
+        }
+    } else if (type == 'E'){
+        complete = 1;
+        t_end = t;
+        write_csv();
+    }
+    next++;
+    if (stall_after >= 0 && next > stall_after){
+        stalled = 1;
+        stall_after = -1;
+    }
+}
+
+static void usage(void){
+    fprintf(stderr,
+        "usage: logrx [-o FILE] [-s N]\n"
+        "  -o FILE   write the runs as CSV to FILE (default stderr)\n"
+        "  -s N      stop answering after frame N until the next header, to try resuming\n");
+    exit(2);
+}
+
+int main(int argc, char **argv){
+    int c;
+    while ((c = getopt(argc, argv, "o:s:")) != -1){
+        switch (c){
+            case 'o': csv_file = optarg; break;
+            case 's': stall_after = atoi(optarg); break;
+            default: usage();
+        }
+    }
+
+    char line[4 * MAX_FRAME + 64];
+    while (fgets(line, sizeof line, stdin)){
+        char op;
+        double t;
+        int pos;
+        if (sscanf(line, "%c %lf%n", &op, &t, &pos) != 2){
+            continue;
+        }
+        if (op == 'W'){
+            unsigned char b[MAX_FRAME];
+            int n = 0;
+            char *p = line + pos, *end;
+            while (n < MAX_FRAME){
+                unsigned long v = strtoul(p, &end, 16);
+                if (end == p){
+                    break;
+                }
+                b[n++] = (unsigned char)v;
+                p = end;
+            }
+            if (n && b[0] == SOF && b[1] == 'H'){
+                stalled = 0;
+            }
+            frame(t, b, n);
+        } else if (op == 'R'){
+            int count = atoi(line + pos);
+            for (int i = 0; i < count; i++){
+                //Status, then the frame wanted next; a stalled PC reads as busy
+                unsigned char v = i == 0 ? (stalled ? 0 : READY) : i == 1 ? next : 0;
+                printf(i ? " %02x" : "%02x", v);
+            }
+            printf("\n");
+            fflush(stdout);
+        }
+    }
+
+    if (complete){
+        double s = t_end - t_start;
+        fprintf(stderr, "logrx: %u runs in %.3f s, %lu bytes (%.0f B/s), %lu frames, %lu bad, %lu out of order, %lu resumed\n",
+                header[1], s, bytes, s > 0 ? bytes / s : 0.0, frames, bad_crc, out_of_order, resumed);
+    } else {
+        fprintf(stderr, "logrx: no complete log received (%lu frames, %lu bad)\n", frames, bad_crc);
+    }
+    return complete ? 0 : 1;
+}
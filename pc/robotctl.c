@@ -0,0 +1,322 @@
+/*
+ * File:   robotctl.c
+ *
+ * Host end of the robot's EUSART command link (source/link.h), for a
+ * USB serial adapter on RC6/RC7 or the simulator's pty:
+ *
+ *   robotctl info                       firmware and link settings
+ *   robotctl status [-w MS]             live counters, every MS ms with -w
+ *   robotctl time                       read the RTC
+ *   robotctl settime "YY-MM-DD HH:MM:SS"
+ *   robotctl logs [-o FILE]             every stored run as CSV
+ *   robotctl profile                    phase times of each bottle this run
+ *
+ * The device comes from -d, or $ROBOT_TTY as robot-sim --uart sets it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <poll.h>
+#include <getopt.h>
+
+#define SOF             0xA5
+#define REPLY           0x80
+#define MAX_PAYLOAD     48
+#define RECORD          40      //As in the log export
+#define PHASES          8
+#define TIMEOUT_MS      500
+#define TRIES           3
+
+#define LINK_INFO       0x01
+#define LINK_STATUS     0x02
+#define LINK_GET_TIME   0x03
+#define LINK_SET_TIME   0x04
+#define LINK_LOG        0x05
+#define LINK_PROFILE    0x06
+#define LINK_ERROR      0x7F
+
+static const char *phase_names[PHASES] = {
+    "detect", "sense", "to_post", "post", "to_bottom", "servo", "tip", "return"
+};
+
+static int fd = -1;
+static unsigned long exchanges, retries;
+
+static unsigned char crc8(const unsigned char *p, int len){
+    unsigned char crc = 0xFF;
+    while (len--){
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++){
+            crc = (crc & 0x80) ? (unsigned char)((crc << 1) ^ 0x07) : (unsigned char)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static void open_tty(const char *dev, speed_t speed){
+    struct termios tio;
+    fd = open(dev, O_RDWR | O_NOCTTY);
+    if (fd < 0 || tcgetattr(fd, &tio)){
+        perror(dev);
+        exit(1);
+    }
+    cfmakeraw(&tio);
+    cfsetspeed(&tio, speed);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tcsetattr(fd, TCSANOW, &tio);
+    tcflush(fd, TCIOFLUSH);
+}
+
+static int read_byte(unsigned char *c){
+    struct pollfd p = { .fd = fd, .events = POLLIN };
+    if (poll(&p, 1, TIMEOUT_MS) <= 0){
+        return 0;
+    }
+    return read(fd, c, 1) == 1;
+}
+
+//Sends a request and waits for its answer; returns the payload length or -1
+static int exchange(unsigned char cmd, const unsigned char *req, int len, unsigned char *ans){
+    unsigned char f[5 + MAX_PAYLOAD];
+    f[0] = SOF;
+    f[1] = cmd;
+    f[2] = (unsigned char)len;
+    memcpy(f + 3, req, len);
+    f[3 + len] = crc8(f + 1, len + 2);
+
+    for (int attempt = 0; attempt < TRIES; attempt++){
+        if (attempt){
+            retries++;
+        }
+        tcflush(fd, TCIFLUSH);
+        if (write(fd, f, len + 4) != len + 4){
+            perror("write");
+            exit(1);
+        }
+        unsigned char r[4 + MAX_PAYLOAD], c;
+        int got = -1;
+        while (read_byte(&c)){
+            if (got < 0){
+                if (c == SOF){
+                    got = 0;
+                }
+                continue;
+            }
+            r[got++] = c;
+            if (got == 2 && r[1] > MAX_PAYLOAD){
+                break;
+            }
+            if (got >= 3 && got == r[1] + 3){
+                break;
+            }
+        }
+        if (got < 3 || got != r[1] + 3 || crc8(r, r[1] + 2) != r[r[1] + 2]){
+            continue;
+        }
+        exchanges++;
+        if (r[0] == (LINK_ERROR | REPLY)){
+            fprintf(stderr, "robotctl: robot rejected command 0x%02x\n", cmd);
+            return -1;
+        }
+        if (r[0] != (cmd | REPLY)){
+            continue;
+        }
+        memcpy(ans, r + 2, r[1]);
+        return r[1];
+    }
+    fprintf(stderr, "robotctl: no answer to command 0x%02x\n", cmd);
+    return -1;
+}
+
+static unsigned bcd(unsigned char v){
+    return (v >> 4) * 10 + (v & 0x0F);
+}
+
+static unsigned long le32(const unsigned char *p){
+    return p[0] | (p[1] << 8) | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static int cmd_info(void){
+    unsigned char a[MAX_PAYLOAD];
+    if (exchange(LINK_INFO, 0, 0, a) < 10){
+        return 1;
+    }
+    printf("link version %u, export version %u\n", a[0], a[1]);
+    printf("runs stored  %u of %u\n", a[3], a[2]);
+    printf("pipelined    %s\n", a[4] ? "yes" : "no");
+    printf("lcd busy flag %s\n", a[5] ? "read" : "timed");
+    printf("baud         %lu\n", le32(a + 6));
+    return 0;
+}
+
+static int cmd_status(int watch_ms){
+    static const char *names[] = { "stopped", "menu", "running", "done", "view log", "choose log",
+                                   "no logs", "clear logs", "send logs", "set time", "all stats" };
+    unsigned char a[MAX_PAYLOAD];
+    do {
+        if (exchange(LINK_STATUS, 0, 0, a) < 12){
+            return 1;
+        }
+        printf("%-10s %6.1f s  bottles %2u  yop cap %u no cap %u  eska cap %u no cap %u  sensors %02x\n",
+               a[0] < sizeof names / sizeof *names ? names[a[0]] : "?", le32(a + 7) / 1000.0,
+               a[2], a[3], a[4], a[5], a[6], a[11]);
+        fflush(stdout);
+        if (watch_ms){
+            usleep(watch_ms * 1000);
+        }
+    } while (watch_ms);
+    return 0;
+}
+
+static int cmd_time(void){
+    unsigned char a[MAX_PAYLOAD];
+    if (exchange(LINK_GET_TIME, 0, 0, a) < 7){
+        return 1;
+    }
+    printf("20%02u-%02u-%02u %02u:%02u:%02u\n", bcd(a[6]), bcd(a[5]), bcd(a[4]),
+           bcd(a[2]), bcd(a[1]), bcd(a[0] & 0x7F));
+    return 0;
+}
+
+static int cmd_settime(const char *s){
+    unsigned y, mo, d, h, mi, se;
+    unsigned char r[7], a[MAX_PAYLOAD];
+    if (sscanf(s, "%u-%u-%u %u:%u:%u", &y, &mo, &d, &h, &mi, &se) != 6){
+        fprintf(stderr, "robotctl: time must be \"YY-MM-DD HH:MM:SS\"\n");
+        return 2;
+    }
+    unsigned v[7] = { se, mi, h, 1, d, mo, y % 100 };
+    for (int i = 0; i < 7; i++){
+        r[i] = (unsigned char)(((v[i] / 10) << 4) | (v[i] % 10));
+    }
+    if (exchange(LINK_SET_TIME, r, 7, a) < 1 || !a[0]){
+        fprintf(stderr, "robotctl: the RTC did not take the time\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int cmd_logs(const char *file){
+    unsigned char a[MAX_PAYLOAD];
+    FILE *f = file ? fopen(file, "w") : stdout;
+    if (!f){
+        perror(file);
+        return 1;
+    }
+    if (exchange(LINK_INFO, 0, 0, a) < 10){
+        return 1;
+    }
+    unsigned runs = a[3];
+    fprintf(f, "run,date,time,seconds,yop_cap,yop_nocap,eska_cap,eska_nocap,bottles");
+    for (int p = 0; p < PHASES; p++){
+        fprintf(f, ",%s_min,%s_mean,%s_max", phase_names[p], phase_names[p], phase_names[p]);
+    }
+    fprintf(f, "\n");
+    for (unsigned run = 1; run <= runs; run++){
+        unsigned char n = (unsigned char)run;
+        if (exchange(LINK_LOG, &n, 1, a) < 1 + RECORD){
+            return 1;
+        }
+        const unsigned char *r = a + 1;
+        fprintf(f, "%u,20%02u-%02u-%02u,%02u:%02u:%02u,%.2f,%u,%u,%u,%u,%u",
+                run, r[0], r[1], r[2], r[3], r[4], r[5], le32(r + 12) / 1000.0,
+                r[7], r[8], r[9], r[10], r[11]);
+        //Phases are in 1/32 s
+        for (int p = 0; p < PHASES; p++){
+            fprintf(f, ",%.3f,%.3f,%.3f", r[16 + p] / 32.0, r[24 + p] / 32.0, r[32 + p] / 32.0);
+        }
+        fprintf(f, "\n");
+    }
+    if (f != stdout){
+        fclose(f);
+    }
+    fprintf(stderr, "robotctl: %u runs\n", runs);
+    return 0;
+}
+
+static int cmd_profile(void){
+    unsigned char a[MAX_PAYLOAD], n = 0, bottles;
+    do {
+        if (exchange(LINK_PROFILE, &n, 1, a) < 2 + PHASES){
+            return 1;
+        }
+        bottles = a[1];
+        if (n == 0){
+            printf("bottle");
+            for (int p = 0; p < PHASES; p++){
+                printf(" %9s", phase_names[p]);
+            }
+            printf("\n");
+        }
+        if (n < bottles){
+            printf("%6u", n + 1);
+            for (int p = 0; p < PHASES; p++){
+                printf(" %9.3f", a[2 + p] / 32.0);
+            }
+            printf("\n");
+        }
+    } while (++n < bottles);
+    return 0;
+}
+
+static void usage(void){
+    fprintf(stderr,
+        "usage: robotctl [-d DEV] [-b BAUD] info | status [-w MS] | time |\n"
+        "                settime \"YY-MM-DD HH:MM:SS\" | logs [-o FILE] | profile\n");
+    exit(2);
+}
+
+int main(int argc, char **argv){
+    const char *dev = getenv("ROBOT_TTY"), *out = 0;
+    long baud = 115200;
+    int watch_ms = 0, c;
+
+    while ((c = getopt(argc, argv, "+d:b:")) != -1){
+        switch (c){
+            case 'd': dev = optarg; break;
+            case 'b': baud = atol(optarg); break;
+            default: usage();
+        }
+    }
+    if (optind >= argc || !dev){
+        usage();
+    }
+    const char *cmd = argv[optind];
+    optind++;
+    while ((c = getopt(argc, argv, "w:o:")) != -1){
+        switch (c){
+            case 'w': watch_ms = atoi(optarg); break;
+            case 'o': out = optarg; break;
+            default: usage();
+        }
+    }
+
+    speed_t speed = baud == 9600 ? B9600 : baud == 57600 ? B57600 : baud == 230400 ? B230400 :
+                    baud == 460800 ? B460800 : baud == 921600 ? B921600 : B115200;
+    open_tty(dev, speed);
+
+    int rc;
+    if (!strcmp(cmd, "info")){
+        rc = cmd_info();
+    } else if (!strcmp(cmd, "status")){
+        rc = cmd_status(watch_ms);
+    } else if (!strcmp(cmd, "time")){
+        rc = cmd_time();
+    } else if (!strcmp(cmd, "settime") && optind < argc){
+        rc = cmd_settime(argv[optind]);
+    } else if (!strcmp(cmd, "logs")){
+        rc = cmd_logs(out);
+    } else if (!strcmp(cmd, "profile")){
+        rc = cmd_profile();
+    } else {
+        usage();
+    }
+    if (retries){
+        fprintf(stderr, "robotctl: %lu retries\n", retries);
+    }
+    return rc;
+}
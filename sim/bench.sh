@@ -0,0 +1,50 @@
+#!/bin/sh
+#
+# Throughput benchmark: runs robot-sim over a fixed set of bottle streams
+# and seeds and prints one JSON object per run (see --json in robot-sim),
+# tagged with the git version. Everything runs on virtual time, so the
+# same firmware always gives the same numbers.
+#
+#   ./bench.sh > before.jsonl
+#   ...change the firmware, make...
+#   ./bench.sh > after.jsonl
+#   diff before.jsonl after.jsonl
+
+SIM=${SIM:-./robot-sim}
+OUT=$(mktemp)
+trap 'rm -f "$OUT"' EXIT
+VERSION=$(git describe --always --dirty 2>/dev/null || echo unknown)
+
+MIXED=YC,EN,YN,EC,YC,EN,YN,EC,YC,EN
+
+# name seed hang bottles; hang is the chance a bottle hangs in the hopper
+# until the centrifuge shakes it loose, gaps are ms after the previous
+# bottle arrived. The seed picks which bottles hang, 2 to 7 of the mixed
+# ten at 0.5, so the mixed stream is run over enough seeds to average
+# that out; "hung" in each line says how many did.
+while read -r name seed hang bottles; do
+    case $name in ''|'#'*) continue ;; esac
+    "$SIM" --name "$name" --seed "$seed" --hang "$hang" --bottles "$bottles" --json "$OUT" \
+        --max-time 300 > /dev/null || exit 1
+done <<SCENARIOS
+mixed           1   0.5   $MIXED
+mixed           2   0.5   $MIXED
+mixed           3   0.5   $MIXED
+mixed           4   0.5   $MIXED
+mixed           5   0.5   $MIXED
+mixed           6   0.5   $MIXED
+mixed           7   0.5   $MIXED
+mixed           8   0.5   $MIXED
+free-feed       1   0     $MIXED
+hung-feed       1   0.9   $MIXED
+yop-cap         1   0.5   YC,YC,YC,YC,YC,YC,YC,YC,YC,YC
+yop-nocap       1   0.5   YN,YN,YN,YN,YN,YN,YN,YN,YN,YN
+eska-cap        1   0.5   EC,EC,EC,EC,EC,EC,EC,EC,EC,EC
+eska-nocap      1   0.5   EN,EN,EN,EN,EN,EN,EN,EN,EN,EN
+gaps-6s         1   0.5   YC,EN:6000,YN:6000,EC:6000,YC:6000,EN:6000,YN:6000,EC:6000,YC:6000,EN:6000
+gaps-8s         1   0.5   YC,EN:8000,YN:8000,EC:8000,YC:8000,EN:8000,YN:8000,EC:8000,YC:8000,EN:8000
+gaps-mixed      1   0.5   YC,EN:7000,YN:3000,EC:9000,YC:4000,EN:11000,YN:2000,EC:8000,YC:5000,EN:10000
+starved         1   0.5   YC,EN,YN,EC,YC:30000,EN,YN,EC,YC,EN
+SCENARIOS
+
+sed "s/^{/{\"version\":\"$VERSION\",/" "$OUT"
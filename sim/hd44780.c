@@ -0,0 +1,160 @@
+/*
+ * File:   hd44780.c
+ *
+ * 2x16 HD44780 display decoded from the firmware's LCD pins. Data is
+ * latched on the falling edge of E, in 8-bit mode until the firmware
+ * switches the controller to 4-bit mode. Writes that arrive while the
+ * controller is still executing the previous instruction are counted.
+ * With R/W (RE2) high the busy flag and address counter are read back on
+ * D4-D7, high nibble first.
+ */
+
+#include "sim.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "constants.h"
+
+#define EXEC_NS         (37 * SIM_US)
+#define EXEC_LONG_NS    (1520 * SIM_US)     //clear display and return home
+
+static unsigned char ddram[128];
+static unsigned char addr;
+static int four_bit, have_high, increment = 1;
+static unsigned char high_nibble;
+static int last_e, read_low;
+static sim_time_t busy_until;
+static unsigned long bytes_written, busy_violations;
+static char rows[2][17];
+static int stop_matched, powered;
+
+static void power_on(void){
+    if (!powered){
+        memset(ddram, ' ', sizeof ddram);
+        powered = 1;
+    }
+}
+
+static void trace_screen(void){
+    sim_trace("lcd |%s|%s|", lcd_row(0), lcd_row(1));
+}
+
+static void set_addr(int a){
+    //Two line mode: 0x00-0x27 and 0x40-0x67
+    a &= 0x7F;
+    if (a > 0x27 && a < 0x40){
+        a = a < 0x34 ? 0x40 : 0x27;
+    } else if (a > 0x67){
+        a = 0x00;
+    }
+    addr = (unsigned char)a;
+}
+
+static void instruction(unsigned char d){
+    busy_until = sim_now + EXEC_NS;
+    if (d & 0x80){
+        set_addr(d & 0x7F);
+    } else if (d & 0x40){
+        //CGRAM address, not modelled
+    } else if (d & 0x20){
+        four_bit = !(d & 0x10);
+    } else if (d & 0x10){
+        if (!(d & 0x08)){
+            set_addr(d & 0x04 ? addr + 1 : addr - 1);
+        }
+    } else if (d & 0x08){
+        //Display, cursor and blink on/off, not modelled
+    } else if (d & 0x04){
+        increment = (d & 0x02) != 0;
+    } else if (d & 0x02){
+        addr = 0;
+        busy_until = sim_now + EXEC_LONG_NS;
+    } else if (d & 0x01){
+        memset(ddram, ' ', sizeof ddram);
+        addr = 0;
+        increment = 1;
+        busy_until = sim_now + EXEC_LONG_NS;
+    }
+}
+
+static void data(unsigned char d){
+    busy_until = sim_now + EXEC_NS;
+    ddram[addr] = d;
+    set_addr(increment ? addr + 1 : addr - 1);
+    bytes_written++;
+
+    const char *text = sim_opt.stop_text;
+    if (!stop_matched && text && *text && (strstr(lcd_row(0), text) || strstr(lcd_row(1), text))){
+        stop_matched = 1;
+        sim_request_stop("lcd showed the stop text");
+    }
+    if (sim_tracing){
+        sim_at(sim_now + 20 * SIM_MS, trace_screen);
+    }
+}
+
+static void latch(int rs, unsigned char bus){
+    if (sim_now < busy_until){
+        busy_violations++;
+    }
+    if (!four_bit){
+        //Only D4-D7 are wired, D0-D3 read as zero
+        if (rs){
+            data(bus & 0xF0);
+        } else {
+            instruction(bus & 0xF0);
+        }
+        return;
+    }
+    if (!have_high){
+        high_nibble = bus & 0xF0;
+        have_high = 1;
+        return;
+    }
+    have_high = 0;
+    unsigned char d = (unsigned char)(high_nibble | (bus >> 4));
+    if (rs){
+        data(d);
+    } else {
+        instruction(d);
+    }
+}
+
+static void read_out(void){
+    unsigned char v = (unsigned char)((sim_now < busy_until ? 0x80 : 0) | addr);
+    if (!RS){
+        PORTD = (unsigned char)((PORTD & 0x0F) | (read_low ? v << 4 : v & 0xF0));
+    }
+    read_low = four_bit && !read_low;
+}
+
+void lcd_sample(void){
+    power_on();
+    int e = E;
+    if (LCD_RW){
+        if (e && !last_e){
+            read_out();
+        }
+    } else {
+        read_low = 0;
+        if (last_e && !e){
+            latch(RS, LCD_PORT);
+        }
+    }
+    last_e = e;
+}
+
+const char *lcd_row(int row){
+    power_on();
+    for (int i = 0; i < 16; i++){
+        unsigned char c = ddram[row * 0x40 + i];
+        rows[row][i] = c >= 0x20 && c < 0x7F ? (char)c : '?';
+    }
+    rows[row][16] = 0;
+    return rows[row];
+}
+
+void lcd_report(void){
+    fprintf(stdout, "lcd      %lu characters  %lu writes while busy\n", bytes_written, busy_violations);
+}
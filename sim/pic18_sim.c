@@ -0,0 +1,500 @@
+/*
+ * File:   pic18_sim.c
+ *
+ * Core of the host simulator: special function registers, the virtual
+ * clock, interrupt dispatch, the keypad script and the command line.
+ *
+ * Virtual time only moves when the firmware waits (__delay_*), talks to a
+ * peripheral, or passes through its main loop. Each time it moves, the
+ * outputs are sampled into the robot model and pending interrupts are
+ * delivered by calling the firmware ISR, just like the PIC would between
+ * two instructions.
+ */
+
+#include "sim.h"
+
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stages.h"
+
+//Special function registers
+volatile PORTAbits_t sim_porta;
+volatile PORTBbits_t sim_portb;
+volatile PORTCbits_t sim_portc;
+volatile PORTDbits_t sim_portd;
+volatile PORTEbits_t sim_porte;
+volatile LATAbits_t sim_lata;
+volatile LATBbits_t sim_latb;
+volatile LATCbits_t sim_latc;
+volatile LATDbits_t sim_latd;
+volatile LATEbits_t sim_late;
+volatile TRISAbits_t sim_trisa = { 0xFF };
+volatile TRISBbits_t sim_trisb = { 0xFF };
+volatile TRISCbits_t sim_trisc = { 0xFF };
+volatile TRISDbits_t sim_trisd = { 0xFF };
+volatile TRISEbits_t sim_trise = { 0x07 };
+volatile INTCONbits_t sim_intcon;
+volatile INTCON2bits_t sim_intcon2 = { 0xF5 };
+volatile INTCON3bits_t sim_intcon3 = { 0xC0 };
+volatile PIR1bits_t sim_pir1;
+volatile PIE1bits_t sim_pie1;
+volatile PIR2bits_t sim_pir2;
+volatile PIE2bits_t sim_pie2;
+volatile RCONbits_t sim_rcon;
+volatile T0CONbits_t sim_t0con = { 0xFF };
+volatile unsigned char TMR0L;
+volatile unsigned char TMR0H;
+volatile T1CONbits_t sim_t1con;
+volatile unsigned char TMR1L;
+volatile unsigned char TMR1H;
+volatile T2CONbits_t sim_t2con;
+volatile unsigned char TMR2;
+volatile unsigned char PR2 = 0xFF;
+volatile CCP1CONbits_t sim_ccp1con;
+volatile unsigned char CCPR1L;
+volatile CCP2CONbits_t sim_ccp2con;
+volatile unsigned char CCPR2L;
+volatile T3CONbits_t sim_t3con;
+volatile unsigned char TMR3L;
+volatile unsigned char TMR3H;
+volatile OSCTUNEbits_t sim_osctune;
+volatile unsigned char OSCCON;
+volatile unsigned char ADCON0;
+volatile unsigned char ADCON1;
+
+sim_time_t sim_now;
+int sim_tracing;
+
+struct sim_options sim_opt = {
+    .bottles = "YC,EN,YN,EC,YC,EN,YN,EC,YC,EN",
+    .keys = "A@1500",
+    .stop_text = "DONE",
+    .rtc = "2017-04-01 12:00:00",
+    .max_time_s = 600.0,
+    .loop_us = 20.0,
+    .seed = 1,
+    .hang = 0.5,
+    .home_offset = 40,
+    .stall_from = SIM_NEVER,
+    .stall_to = SIM_NEVER,
+};
+
+//Pending timed callbacks
+#define MAX_EVENTS 32
+
+static struct {
+    sim_time_t t;
+    sim_event_fn fn;
+} events[MAX_EVENTS];
+static int num_events;
+
+void sim_at(sim_time_t t, sim_event_fn fn){
+    for (int i = 0; i < num_events; i++){
+        if (events[i].fn == fn){
+            events[i].t = t;
+            return;
+        }
+    }
+    if (num_events == MAX_EVENTS){
+        fprintf(stderr, "robot-sim: event table full\n");
+        exit(2);
+    }
+    events[num_events].t = t;
+    events[num_events].fn = fn;
+    num_events++;
+}
+
+void sim_cancel(sim_event_fn fn){
+    for (int i = 0; i < num_events; i++){
+        if (events[i].fn == fn){
+            events[i] = events[--num_events];
+            return;
+        }
+    }
+}
+
+static sim_time_t next_event_time(void){
+    sim_time_t t = SIM_NEVER;
+    for (int i = 0; i < num_events; i++){
+        if (events[i].t < t){
+            t = events[i].t;
+        }
+    }
+    return t;
+}
+
+static void run_due_events(void){
+    int ran;
+    do {
+        ran = 0;
+        for (int i = 0; i < num_events; i++){
+            if (events[i].t <= sim_now){
+                sim_event_fn fn = events[i].fn;
+                events[i] = events[--num_events];
+                fn();
+                ran = 1;
+                break;
+            }
+        }
+    } while (ran);
+}
+
+//Interrupts. The PIC18 runs with a single vector (IPEN = 0), so every
+//source lands in the one interrupt function of the firmware.
+#define ISR_OVERHEAD_NS     (2 * SIM_US)
+
+static int in_isr;
+
+static int irq_pending(void){
+    if (INTCON & (INTCON >> 3) & 0x07){
+        return 1;
+    }
+    if ((INTCON3bits.INT1IF && INTCON3bits.INT1IE) || (INTCON3bits.INT2IF && INTCON3bits.INT2IE)){
+        return 1;
+    }
+    if (INTCONbits.PEIE && ((PIR1 & PIE1) || (PIR2 & PIE2))){
+        return 1;
+    }
+    return 0;
+}
+
+static void sample_outputs(void){
+    timers_sample();
+    i2c_sample();
+    eeprom_sample();
+    uart_sample();
+    robot_sample();
+    lcd_sample();
+}
+
+static void dispatch_interrupts(void){
+    int storm = 0;
+    while (!in_isr && INTCONbits.GIE && irq_pending()){
+        if (++storm > 10000){
+            fprintf(stderr, "robot-sim: interrupt flag never cleared (INTCON=%02x INTCON3=%02x PIR1=%02x PIR2=%02x)\n",
+                    INTCON, INTCON3, PIR1, PIR2);
+            exit(2);
+        }
+        in_isr = 1;
+        INTCONbits.GIE = 0;
+        keypressed();
+        sim_elapse(ISR_OVERHEAD_NS);
+        INTCONbits.GIE = 1;
+        in_isr = 0;
+        sample_outputs();
+    }
+}
+
+void sim_elapse(sim_time_t ns){
+    sim_time_t end = sim_now + ns;
+    for (;;){
+        sample_outputs();
+        dispatch_interrupts();
+        if (sim_now >= end){
+            break;
+        }
+        //Events set for a time already past run now; the clock never
+        //goes back
+        sim_time_t t = next_event_time();
+        if (t < sim_now){
+            t = sim_now;
+        }
+        sim_now = t < end ? t : end;
+        run_due_events();
+    }
+}
+
+void sim_delay_ns(unsigned long long ns){
+    sim_elapse(ns);
+}
+
+void sim_loop_idle(void){
+    sim_elapse((sim_time_t)(sim_opt.loop_us * SIM_US));
+}
+
+void sim_trace(const char *fmt, ...){
+    if (!sim_tracing){
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "[%11.6f] ", sim_now / 1e9);
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+    va_end(ap);
+}
+
+static uint32_t rng_state, hash_seed;
+
+uint32_t sim_rand(void){
+    uint32_t x = rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return rng_state = x;
+}
+
+double sim_uniform(void){
+    return sim_rand() / 4294967296.0;
+}
+
+uint32_t sim_hash(uint32_t a, uint32_t b, uint32_t c){
+    uint32_t h = a * 0x9E3779B1u ^ (b + 0x7F4A7C15u) * 0x85EBCA77u ^ (c + hash_seed) * 0xC2B2AE3Du;
+    h ^= h >> 16;
+    h *= 0x7FEB352Du;
+    h ^= h >> 15;
+    h *= 0x846CA68Bu;
+    h ^= h >> 16;
+    return h;
+}
+
+//Keypad: a 74C922 encoder presents the key on RB4-RB7 and raises DA on
+//RB1/INT1 for as long as the key is held.
+#define KEY_HOLD_NS     (80 * SIM_MS)
+#define MAX_KEYS        64
+
+static const char keymap[] = "123A456B789C*0#D";
+static struct {
+    sim_time_t t;
+    unsigned char code;
+} key_script[MAX_KEYS];
+static int num_keys, next_key;
+static int run_started;
+static sim_time_t run_start_time;
+
+static void key_release(void){
+    PORTBbits.RB1 = 0;
+}
+
+static void key_press(void){
+    unsigned char code = key_script[next_key].code;
+    sim_trace("key %c", keymap[code]);
+    PORTB = (unsigned char)((PORTB & 0x0F) | (code << 4));
+    PORTBbits.RB1 = 1;
+    INTCON3bits.INT1IF = 1;
+    sim_at(sim_now + KEY_HOLD_NS, key_release);
+    if (keymap[code] == 'A' && !run_started){
+        run_started = 1;
+        run_start_time = sim_now;
+        robot_run_start();
+    }
+    if (++next_key < num_keys){
+        sim_at(key_script[next_key].t, key_press);
+    }
+}
+
+static void parse_keys(const char *spec){
+    const char *p = spec;
+    while (*p && num_keys < MAX_KEYS){
+        const char *k = strchr(keymap, *p);
+        if (!k || p[1] != '@'){
+            fprintf(stderr, "robot-sim: bad key script near \"%s\"\n", p);
+            exit(2);
+        }
+        char *end;
+        double ms = strtod(p + 2, &end);
+        key_script[num_keys].code = (unsigned char)(k - keymap);
+        key_script[num_keys].t = (sim_time_t)(ms * SIM_MS);
+        num_keys++;
+        p = end;
+        if (*p == ','){
+            p++;
+        }
+    }
+    if (num_keys){
+        sim_at(key_script[0].t, key_press);
+    }
+}
+
+//Stopping and reporting
+static const char *stop_reason = "time limit";
+
+//Stage timing as measured by the firmware itself
+static void stages_report(void){
+    static const char *names[NUM_STAGES] = {
+        "type", "edge", "to-post", "post", "to-bottom", "servo", "tip", "return", "feed"
+    };
+    fprintf(stdout, "stages  ");
+    for (int i = 0; i < NUM_STAGES; i++){
+        fprintf(stdout, " %s %u", names[i], StageMean((unsigned char)i));
+    }
+    fprintf(stdout, "  (firmware, mean ms)\n");
+}
+
+//One JSON object per run for the benchmark suite (bench.sh), appended to
+//--json FILE. Phases are the firmware's own stage means.
+static void json_report(double run_s){
+    static const char *names[NUM_STAGES] = {
+        "type", "edge", "to_post", "post", "to_bottom", "servo", "drop", "home", "detect"
+    };
+    struct robot_stats st;
+    FILE *f = fopen(sim_opt.json_file, "a");
+    if (!f){
+        perror(sim_opt.json_file);
+        return;
+    }
+    robot_stats(&st);
+    fprintf(f, "{\"scenario\":\"%s\",\"seed\":%u,\"hang\":%.2f,\"stop\":\"%s\",\"bottles\":\"%s\","
+               "\"fed\":%d,\"hung\":%d,\"sorted\":%d,\"correct\":%d,\"run_s\":%.3f,\"bottles_per_min\":%.2f,"
+               "\"cycle_ms\":{\"mean\":%.0f,\"p50\":%.0f,\"p95\":%.0f,\"p99\":%.0f,\"max\":%.0f},\"phase_ms\":{",
+            sim_opt.name ? sim_opt.name : "", sim_opt.seed, sim_opt.hang, stop_reason, sim_opt.bottles,
+            st.fed, st.hung, st.sorted, st.correct, run_s, run_s > 0 ? st.sorted * 60.0 / run_s : 0.0,
+            st.cycle_mean, st.cycle_p50, st.cycle_p95, st.cycle_p99, st.cycle_max);
+    for (int i = 0; i < NUM_STAGES; i++){
+        fprintf(f, "%s\"%s\":%u", i ? "," : "", names[i], StageMean((unsigned char)i));
+    }
+    fprintf(f, "}}\n");
+    fclose(f);
+}
+
+//Longest the EEPROM gets to write out what the firmware queued before the
+//image is saved, a record and a profile with time to spare
+#define EEPROM_DRAIN_NS     (500 * SIM_MS)
+
+static sim_time_t stop_time = SIM_NEVER;
+
+static void finish(void){
+    if (stop_time == SIM_NEVER){
+        stop_time = sim_now;
+    }
+    if (eeprom_busy() && sim_now - stop_time < EEPROM_DRAIN_NS){
+        sim_at(sim_now + SIM_MS, finish);
+        return;
+    }
+
+    //Everything is reported as of the stop
+    double end_s = stop_time / 1e9;
+    double run_s = run_started ? (stop_time - run_start_time) / 1e9 : 0.0;
+
+    fprintf(stdout, "robot-sim: stopped at %.3f s (%s)\n", end_s, stop_reason);
+    fprintf(stdout, "lcd      |%s|\n         |%s|\n", lcd_row(0), lcd_row(1));
+    robot_report(run_s);
+    stages_report();
+    lcd_report();
+    i2c_report();
+    uart_report();
+    eeprom_report();
+    if (sim_opt.json_file){
+        json_report(run_s);
+    }
+    eeprom_save();
+    fflush(stdout);
+    exit(0);
+}
+
+void sim_request_stop(const char *why){
+    static int requested;
+    if (requested){
+        return;
+    }
+    requested = 1;
+    stop_reason = why;
+    //Let the firmware finish drawing the screen before reporting
+    sim_at(sim_now + 100 * SIM_MS, finish);
+}
+
+//Prints the options, to stdout when asked for with --help
+static void usage(int status){
+    fprintf(status ? stderr : stdout,
+        "usage: robot-sim [options]\n"
+        "  -b, --bottles LIST   bottle stream, e.g. YC,EN:2000,... (type Y/E, cap C/N,\n"
+        "                       optional gap in ms before the bottle arrives)\n"
+        "  -k, --keys LIST      keypad script, e.g. A@1500,B@9000 (key@ms)\n"
+        "  -s, --stop TEXT      stop when the LCD shows TEXT (default DONE)\n"
+        "  -t, --max-time S     stop after S seconds of virtual time (default 600)\n"
+        "  -e, --eeprom FILE    load and save the data EEPROM image\n"
+        "  -p, --pc-out FILE    save bytes received by the PC on the I2C bus\n"
+        "  -x, --pc-cmd CMD     run CMD as the PC end of the log export (pc/logrx)\n"
+        "  -C, --pc-corrupt N   flip a bit in every Nth write to the PC\n"
+        "  -u, --uart           put the EUSART on a pty ($ROBOT_TTY) and run in real time\n"
+        "  -U, --uart-cmd CMD   as --uart, and run CMD alongside (e.g. pc/robotctl)\n"
+        "  -r, --rtc TIME       initial DS1307 time, \"YYYY-MM-DD HH:MM:SS\"\n"
+        "  -l, --loop-us US     cost of one main loop pass (default 20)\n"
+        "  -o, --home-offset N  carriage start position in half steps (default 40)\n"
+        "  -L, --stall S[:MS]   jam the carriage at S seconds for MS (default 1000)\n"
+        "  -S, --seed N         seed for sensor noise and the feed (default 1)\n"
+        "  -H, --hang P         chance a bottle hangs in the hopper (default 0.5)\n"
+        "  -j, --json FILE      append the results to FILE as one line of JSON\n"
+        "  -n, --name NAME      scenario name for --json\n"
+        "  -v, --trace          trace keys, bottles and LCD screens to stderr\n"
+        "  -h, --help           show this help\n");
+    exit(status);
+}
+
+int main(int argc, char **argv){
+    static const struct option longopts[] = {
+        { "bottles", required_argument, 0, 'b' },
+        { "keys", required_argument, 0, 'k' },
+        { "stop", required_argument, 0, 's' },
+        { "max-time", required_argument, 0, 't' },
+        { "eeprom", required_argument, 0, 'e' },
+        { "pc-out", required_argument, 0, 'p' },
+        { "pc-cmd", required_argument, 0, 'x' },
+        { "pc-corrupt", required_argument, 0, 'C' },
+        { "uart", no_argument, 0, 'u' },
+        { "uart-cmd", required_argument, 0, 'U' },
+        { "rtc", required_argument, 0, 'r' },
+        { "loop-us", required_argument, 0, 'l' },
+        { "home-offset", required_argument, 0, 'o' },
+        { "stall", required_argument, 0, 'L' },
+        { "seed", required_argument, 0, 'S' },
+        { "hang", required_argument, 0, 'H' },
+        { "json", required_argument, 0, 'j' },
+        { "name", required_argument, 0, 'n' },
+        { "trace", no_argument, 0, 'v' },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "b:k:s:t:e:p:x:C:uU:r:l:o:L:S:H:j:n:vh", longopts, 0)) != -1){
+        switch (c){
+            case 'b': sim_opt.bottles = optarg; break;
+            case 'k': sim_opt.keys = optarg; break;
+            case 's': sim_opt.stop_text = optarg; break;
+            case 't': sim_opt.max_time_s = atof(optarg); break;
+            case 'e': sim_opt.eeprom_file = optarg; break;
+            case 'p': sim_opt.pc_out_file = optarg; break;
+            case 'x': sim_opt.pc_cmd = optarg; break;
+            case 'C': sim_opt.pc_corrupt = (unsigned)atoi(optarg); break;
+            case 'u': sim_opt.uart = 1; break;
+            case 'U': sim_opt.uart = 1; sim_opt.uart_cmd = optarg; break;
+            case 'r': sim_opt.rtc = optarg; break;
+            case 'l': sim_opt.loop_us = atof(optarg); break;
+            case 'o': sim_opt.home_offset = atoi(optarg); break;
+            case 'L': {
+                char *end;
+                sim_opt.stall_from = (sim_time_t)(strtod(optarg, &end) * SIM_S);
+                sim_opt.stall_to = sim_opt.stall_from + (sim_time_t)((*end == ':' ? atof(end + 1) : 1000.0) * SIM_MS);
+                break;
+            }
+            case 'S': sim_opt.seed = (unsigned)strtoul(optarg, 0, 0); break;
+            case 'H': sim_opt.hang = atof(optarg); break;
+            case 'j': sim_opt.json_file = optarg; break;
+            case 'n': sim_opt.name = optarg; break;
+            case 'v': sim_tracing = 1; break;
+            case 'h': usage(0); break;
+            default: usage(2);
+        }
+    }
+    if (optind != argc){
+        usage(2);
+    }
+
+    rng_state = sim_opt.seed * 2654435761u + 1;
+    hash_seed = sim_opt.seed;
+    robot_init();
+    i2c_init();
+    eeprom_init();
+    uart_init();
+    parse_keys(sim_opt.keys);
+    sim_at((sim_time_t)(sim_opt.max_time_s * SIM_S), finish);
+
+    firmware_main();
+    stop_reason = "firmware returned from main";
+    finish();
+    return 0;
+}
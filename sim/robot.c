@@ -0,0 +1,547 @@
+/*
+ * File:   robot.c
+ *
+ * Mechanical model of the sorting robot as seen from the PIC pins:
+ * the stepper driven carriage with its home switch, the bin selector
+ * servo, the centrifuge H-bridge, the five bottle sensors and a scripted
+ * stream of bottles. Pin names come from the firmware's constants.h so the
+ * model always follows the firmware pin map.
+ */
+
+#include "sim.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "stepper.h"
+
+//Carriage, in half steps below the top stop
+#define POS_TOP_ZONE        10      //existence, type and edge sensors see the bottle
+#define POS_POST            360     //post sensors
+#define POS_POST_WINDOW     25
+#define POS_TIP             660     //carriage tips over below this...
+#define TIP_RISE            16      //...and lets go of the bottle once it rises again
+#define POS_BOTTOM          720
+
+//Stepper dynamics. Steps faster than the motor can follow are lost.
+#define PULL_IN_RATE        1200.0  //half steps/s, start or reverse without ramp
+#define MAX_RATE            6000.0
+#define MAX_ACCEL           30000.0 //half steps/s^2
+#define RATE_SLACK          1.02    //a few us of step jitter is absorbed by the rotor
+
+//Bin servo, position in pulse width microseconds
+#define SERVO_SPEED         3333.0  //us of pulse width per second (~0.2 s/60 deg)
+#define SERVO_HOLD_NS       (25 * SIM_MS)
+#define SERVO_MIN_US        500
+#define SERVO_MAX_US        2600
+#define BIN_TOLERANCE_US    120
+
+//Bottles and sensors
+#define MAX_BOTTLES         256
+#define LOAD_SETTLE_NS      (250 * SIM_MS)
+#define MOTION_SETTLE_NS    (150 * SIM_MS)
+#define SENSOR_WARMUP_NS    (20 * SIM_MS)
+#define SENSOR_SEGMENT_NS   (10 * SIM_MS)
+#define FALL_NS             (300 * SIM_MS)    //from release to landing in a bin
+
+//Feed: a bottle may hang in the hopper until the centrifuge works it loose.
+//Agitation counts at the drum's speed once that is over MOTOR_USEFUL, and
+//only for the bottle's bite time into each spell in one direction; past
+//that it spins round the bottle. A current spike, as from reversing at
+//full speed, wedges a hung bottle by JAM_NS more one time in JAM_ODDS.
+#define HANG_MIN_NS         (300 * SIM_MS)    //agitation a hung bottle needs
+#define HANG_SPREAD_NS      (1500 * SIM_MS)
+#define BITE_MIN_NS         (400 * SIM_MS)
+#define BITE_SPREAD_NS      (1600 * SIM_MS)
+#define JAM_NS              (300 * SIM_MS)
+#define JAM_ODDS            3
+
+//Centrifuge motor: the speed follows the mean drive with MOTOR_TAU_NS, the
+//current is the drive less the back EMF, 1.0 being a start from rest at
+//full drive. Over MOTOR_SPIKE_I it counts as a spike.
+#define MOTOR_TAU_NS        (80 * SIM_MS)
+#define MOTOR_USEFUL        0.5
+#define MOTOR_SPIKE_I       1.5
+
+static const unsigned char phases[8] = {0x08,0x0c,0x04,0x06,0x02,0x03,0x01,0x09};
+static const int bin_center_us[5] = {0, 800, 1450, 1770, 2400};
+
+//Chance that a sensor reports "cap" while the bottle is settled, [yop][cap]
+static const double edge_p[2][2] = {{0.05, 0.75}, {0.10, 0.95}};
+static const double post_p[2][2] = {{0.05, 0.75}, {0.10, 0.95}};
+static const double type_p[2] = {0.02, 0.98};
+
+enum { SENSE_TYPE, SENSE_EDGE, SENSE_POST, FEED_HANG, FEED_NEED, FEED_BITE, FEED_JAM };
+enum { PWR_EDGE, PWR_POST, PWR_TOP, NUM_PWR };
+
+struct bottle {
+    unsigned char yop;
+    unsigned char cap;
+    sim_time_t gap;
+    sim_time_t arrive;
+    sim_time_t need;        //agitation before it reaches the chute
+    sim_time_t bite;
+    sim_time_t work;
+    sim_time_t load;
+    sim_time_t depart;
+    int deepest;
+    sim_time_t release;
+    sim_time_t drop;
+    sim_time_t home;
+    int bin;
+};
+
+static struct bottle bottles[MAX_BOTTLES];
+static int num_bottles, next_bottle, carriage = -1, falling = -1, last_dropped = -1;
+static int feeding;
+
+static int pos;
+static int phase = -1;
+static unsigned char last_pattern;
+static int last_dir;
+static double rotor_rate;
+static sim_time_t last_step_t, last_motion_t;
+static unsigned long steps, lost_steps, phase_errors;
+
+static double servo_us = 1500.0, servo_cmd = 1500.0;
+static sim_time_t servo_t, servo_drive_until, pulse_rise;
+static int servo_level;
+static unsigned long servo_pulses, servo_bad_pulses;
+
+static double motor_drive, motor_speed, motor_peak_i;
+static int motor_dir, motor_both, motor_spiking;
+static int spell_dir;                   //of the drum while over MOTOR_USEFUL
+static sim_time_t motor_t, spell_start, motor_on_ns;
+static unsigned long motor_reversals, motor_shoot_through, motor_spikes;
+
+static sim_time_t warm_since[NUM_PWR] = {SIM_NEVER, SIM_NEVER, SIM_NEVER};
+
+static int expected_bin(const struct bottle *b){
+    return b->yop ? (b->cap ? 1 : 2) : (b->cap ? 3 : 4);
+}
+
+static const char *bottle_name(const struct bottle *b){
+    static const char *names[2][2] = {{"Eska no cap", "Eska cap"}, {"Yop no cap", "Yop cap"}};
+    return names[b->yop][b->cap];
+}
+
+void robot_init(void){
+    const char *p = sim_opt.bottles;
+    while (*p && num_bottles < MAX_BOTTLES){
+        struct bottle *b = &bottles[num_bottles];
+        if ((p[0] != 'Y' && p[0] != 'E') || (p[1] != 'C' && p[1] != 'N')){
+            fprintf(stderr, "robot-sim: bad bottle list near \"%s\"\n", p);
+            exit(2);
+        }
+        b->yop = p[0] == 'Y';
+        b->cap = p[1] == 'C';
+        p += 2;
+        if (*p == ':'){
+            char *end;
+            b->gap = (sim_time_t)(strtod(p + 1, &end) * SIM_MS);
+            p = end;
+        }
+        if (*p == ','){
+            p++;
+        }
+        num_bottles++;
+    }
+    pos = sim_opt.home_offset;
+    HOME_SWITCH = pos > 0;
+}
+
+static void bottle_arrival(void){
+    //Nothing to do; the next sample picks the bottle up
+}
+
+void robot_run_start(void){
+    sim_time_t t = sim_now;
+    for (int i = 0; i < num_bottles; i++){
+        struct bottle *b = &bottles[i];
+        t += b->gap;
+        b->arrive = t;
+        if (sim_hash((uint32_t)i, FEED_HANG, 0) < sim_opt.hang * 4294967296.0){
+            b->need = HANG_MIN_NS + (sim_time_t)(sim_hash((uint32_t)i, FEED_NEED, 0) / 4294967296.0 * HANG_SPREAD_NS);
+            b->bite = BITE_MIN_NS + (sim_time_t)(sim_hash((uint32_t)i, FEED_BITE, 0) / 4294967296.0 * BITE_SPREAD_NS);
+        }
+    }
+    feeding = 1;
+    if (num_bottles){
+        sim_at(bottles[0].arrive, bottle_arrival);
+    }
+}
+
+static void sample_stepper(void){
+    unsigned char pattern = STEPPER_PORT & 0x0F;
+    if (pattern == last_pattern){
+        return;
+    }
+    last_pattern = pattern;
+
+    int idx = -1;
+    for (int i = 0; i < 8; i++){
+        if (phases[i] == pattern){
+            idx = i;
+        }
+    }
+    if (idx < 0 || phase < 0){
+        //Released, or energised again: the rotor snaps to the new phase
+        phase = idx;
+        rotor_rate = 0;
+        return;
+    }
+    int d = (idx - phase + 8) % 8;
+    phase = idx;
+    if (d != 1 && d != 7){
+        phase_errors++;
+        rotor_rate = 0;
+        return;
+    }
+
+    if (sim_now >= sim_opt.stall_from && sim_now < sim_opt.stall_to){
+        lost_steps++;           //Jammed, the rotor just slips
+        rotor_rate = 0;
+        return;
+    }
+
+    int dir = d == 1 ? -1 : 1;  //Stepping through CW[] raises the carriage
+    double dt = (sim_now - last_step_t) / 1e9;
+    double rate = dt > 0 ? 1.0 / dt : INFINITY;
+    double allowed = PULL_IN_RATE;
+    if (rotor_rate > 0 && dir == last_dir && dt < 2.0 / PULL_IN_RATE){
+        allowed = fmax(PULL_IN_RATE, rotor_rate + MAX_ACCEL * dt);
+    }
+    last_step_t = sim_now;
+    if (rate > allowed * RATE_SLACK || rate > MAX_RATE){
+        lost_steps++;
+        rotor_rate = 0;
+        return;
+    }
+    rotor_rate = rate;
+    last_dir = dir;
+    steps++;
+    pos += dir;
+    if (pos < 0){
+        pos = 0;    //Against the top stop
+    }
+    if (pos > POS_BOTTOM){
+        pos = POS_BOTTOM;
+    }
+    last_motion_t = sim_now;
+}
+
+static void servo_advance(sim_time_t t){
+    sim_time_t until = t < servo_drive_until ? t : servo_drive_until;
+    if (until > servo_t){
+        double travel = SERVO_SPEED * (until - servo_t) / 1e9;
+        if (fabs(servo_cmd - servo_us) <= travel){
+            servo_us = servo_cmd;
+        } else {
+            servo_us += servo_cmd > servo_us ? travel : -travel;
+        }
+    }
+    servo_t = t;
+}
+
+static void sample_servo(void){
+    int level = BIN_SERVO;
+    if (level == servo_level){
+        return;
+    }
+    servo_level = level;
+    if (level){
+        pulse_rise = sim_now;
+        return;
+    }
+    double width = (sim_now - pulse_rise) / 1e3;
+    if (width < SERVO_MIN_US || width > SERVO_MAX_US){
+        servo_bad_pulses++;
+        return;
+    }
+    servo_advance(sim_now);
+    servo_cmd = width;
+    servo_drive_until = sim_now + SERVO_HOLD_NS;
+    servo_pulses++;
+}
+
+//Mean level of a centrifuge pin: the duty cycle while its CCP module is
+//in PWM mode, else the latch
+static double pin_drive(unsigned con, unsigned ccpr, int lat){
+    if ((con & 0x0C) != 0x0C){
+        return lat;
+    }
+    if (!T2CONbits.TMR2ON){
+        return 0;
+    }
+    double d = (ccpr << 2 | (con >> 4 & 0x03)) / (4.0 * (PR2 + 1));
+    return d < 1 ? d : 1;
+}
+
+//Works the next bottle loose at the drum's speed over the part of the
+//last sample since it arrived and within the spell's bite
+static void feed_work(sim_time_t from){
+    sim_time_t to = sim_now;
+    if (!feeding || next_bottle >= num_bottles || !spell_dir){
+        return;
+    }
+    struct bottle *b = &bottles[next_bottle];
+    if (from < b->arrive){
+        from = b->arrive;
+    }
+    if (from < spell_start){
+        from = spell_start;
+    }
+    if (to > spell_start + b->bite){
+        to = spell_start + b->bite;
+    }
+    if (to > from && b->work < b->need){
+        b->work += (sim_time_t)((to - from) * fabs(motor_speed));
+        if (b->work >= b->need){
+            sim_trace("bottle %d worked loose", next_bottle + 1);
+        }
+    }
+}
+
+//CCP1 drives RC2 and CCP2 RC1 (CCP2MX = PORTC in configBits.h)
+static void sample_centrifuge(void){
+    double fwd = pin_drive(CCP1CON, CCPR1L, CENTRIFUGE_FWD);
+    double rev = pin_drive(CCP2CON, CCPR2L, CENTRIFUGE_REV);
+    sim_time_t dt = sim_now - motor_t;
+
+    motor_t = sim_now;
+    if (dt > 0){
+        double a = (double)dt / MOTOR_TAU_NS;
+        motor_speed += (motor_drive - motor_speed) * (a < 1 ? a : 1);
+        if (motor_drive != 0){
+            motor_on_ns += dt;
+        }
+        int dir = motor_speed >= MOTOR_USEFUL ? 1 : motor_speed <= -MOTOR_USEFUL ? -1 : 0;
+        if (dir != spell_dir){
+            spell_dir = dir;
+            spell_start = sim_now;
+        }
+        feed_work(sim_now - dt);
+    }
+
+    if (fwd > 0 && rev > 0 && !motor_both){
+        motor_shoot_through++;
+    }
+    motor_both = fwd > 0 && rev > 0;
+    motor_drive = fwd - rev;
+    int dir = motor_drive > 0 ? 1 : motor_drive < 0 ? -1 : 0;
+    if (dir && motor_dir && dir != motor_dir){
+        motor_reversals++;
+    }
+    if (dir){
+        motor_dir = dir;
+    }
+
+    double i = fabs(motor_drive - motor_speed);
+    if (i > motor_peak_i){
+        motor_peak_i = i;
+    }
+    if (i > MOTOR_SPIKE_I && !motor_spiking){
+        motor_spikes++;
+        if (feeding && next_bottle < num_bottles){
+            struct bottle *b = &bottles[next_bottle];
+            if (b->arrive <= sim_now && b->work < b->need &&
+                    sim_hash((uint32_t)next_bottle, FEED_JAM, (uint32_t)motor_spikes) % JAM_ODDS == 0){
+                b->need += JAM_NS;
+                sim_trace("bottle %d jammed by a current spike", next_bottle + 1);
+            }
+        }
+    }
+    motor_spiking = i > MOTOR_SPIKE_I;
+}
+
+static void sample_power(void){
+    int on[NUM_PWR] = {EDGE_SENSOR_PWR, POST_SENSOR_PWR, TOP_SENSOR_PWR};
+    for (int i = 0; i < NUM_PWR; i++){
+        if (!on[i]){
+            warm_since[i] = SIM_NEVER;
+        } else if (warm_since[i] == SIM_NEVER){
+            warm_since[i] = sim_now + SENSOR_WARMUP_NS;
+        }
+    }
+}
+
+//The bin chute is wherever the servo points when the bottle reaches it
+static void bottle_land(void){
+    struct bottle *b = &bottles[falling];
+    servo_advance(sim_now);
+    b->drop = sim_now;
+    b->bin = 0;
+    for (int i = 1; i <= 4; i++){
+        if (fabs(servo_us - bin_center_us[i]) <= BIN_TOLERANCE_US){
+            b->bin = i;
+        }
+    }
+    sim_trace("bottle %d (%s) landed in bin %d%s", falling + 1, bottle_name(b), b->bin,
+              b->bin == expected_bin(b) ? "" : " (WRONG)");
+    falling = -1;
+}
+
+static void update_bottles(void){
+    if (carriage < 0 && feeding && next_bottle < num_bottles &&
+            bottles[next_bottle].arrive <= sim_now &&
+            bottles[next_bottle].work >= bottles[next_bottle].need && pos <= 2){
+        carriage = next_bottle++;
+        bottles[carriage].load = sim_now;
+        sim_trace("bottle %d (%s) loaded", carriage + 1, bottle_name(&bottles[carriage]));
+        if (next_bottle < num_bottles){
+            sim_at(bottles[next_bottle].arrive, bottle_arrival);
+        }
+    }
+    if (carriage >= 0){
+        struct bottle *b = &bottles[carriage];
+        if (!b->depart && pos > POS_TOP_ZONE){
+            b->depart = sim_now;
+        }
+        if (pos >= POS_TIP && pos > b->deepest){
+            b->deepest = pos;
+        }
+        if (b->deepest && pos <= b->deepest - TIP_RISE){
+            b->release = sim_now;
+            if (falling >= 0){
+                bottle_land();
+            }
+            falling = last_dropped = carriage;
+            carriage = -1;
+            sim_at(sim_now + FALL_NS, bottle_land);
+        }
+    }
+    if (last_dropped >= 0 && !bottles[last_dropped].home && pos <= 2){
+        bottles[last_dropped].home = sim_now;
+    }
+}
+
+static int warm(int pwr){
+    return warm_since[pwr] <= sim_now;
+}
+
+static int reading(int sensor, double p){
+    uint32_t seg = (uint32_t)(sim_now / SENSOR_SEGMENT_NS);
+    return sim_hash((uint32_t)carriage, (uint32_t)sensor, seg) < p * 4294967296.0;
+}
+
+static void update_inputs(void){
+    int top = 0, edge = 0, post = 0, type = 0;
+    if (carriage >= 0){
+        const struct bottle *b = &bottles[carriage];
+        int settled = sim_now - b->load >= LOAD_SETTLE_NS;
+        int still = sim_now - last_motion_t >= MOTION_SETTLE_NS;
+        if (pos <= POS_TOP_ZONE){
+            top = warm(PWR_TOP);
+            type = reading(SENSE_TYPE, settled ? type_p[b->yop] : 0.5);
+            if (warm(PWR_EDGE)){
+                edge = reading(SENSE_EDGE, settled && still ? edge_p[b->yop][b->cap] : 0.5);
+            }
+        }
+        if (abs(pos - POS_POST) <= POS_POST_WINDOW && warm(PWR_POST)){
+            post = reading(SENSE_POST, still ? post_p[b->yop][b->cap] : 0.5);
+        }
+        //Each edge and post sensor is aimed at the cap of one bottle type
+        EXIST_SENSOR = top;
+        TYPE_SENSOR = type;
+        YOP_EDGE_SENSOR = b->yop && edge;
+        ESKA_EDGE_SENSOR = !b->yop && edge;
+        YOP_POST_SENSOR = b->yop && post;
+        ESKA_POST_SENSOR = !b->yop && post;
+    } else {
+        EXIST_SENSOR = 0;
+        TYPE_SENSOR = 0;
+        YOP_EDGE_SENSOR = 0;
+        ESKA_EDGE_SENSOR = 0;
+        YOP_POST_SENSOR = 0;
+        ESKA_POST_SENSOR = 0;
+    }
+    //RB0 is also INT0, which flags the edge chosen by INTEDG0
+    int home = pos > 0;
+    if (home != HOME_SWITCH && home == INTCON2bits.INTEDG0){
+        INTCONbits.INT0IF = 1;
+    }
+    HOME_SWITCH = home;
+}
+
+void robot_sample(void){
+    sample_stepper();
+    sample_servo();
+    sample_centrifuge();
+    sample_power();
+    update_bottles();
+    update_inputs();
+}
+
+static int cmp_time(const void *a, const void *b){
+    sim_time_t x = *(const sim_time_t *)a, y = *(const sim_time_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+//Nearest rank percentile of sorted times, in ms
+static double percentile(const sim_time_t *t, int n, int p){
+    int rank = (n * p + 99) / 100;
+    return t[rank > 0 ? rank - 1 : 0] / 1e6;
+}
+
+void robot_stats(struct robot_stats *st){
+    sim_time_t cycle[MAX_BOTTLES];
+    double total = 0;
+
+    memset(st, 0, sizeof *st);
+    st->fed = next_bottle;
+    for (int i = 0; i < next_bottle; i++){
+        const struct bottle *b = &bottles[i];
+        st->hung += b->need > 0;
+        if (!b->drop){
+            continue;
+        }
+        st->sorted++;
+        st->correct += b->bin == expected_bin(b);
+        if (b->home){
+            cycle[st->homed++] = b->home - b->load;
+            total += (b->home - b->load) / 1e6;
+        }
+    }
+    if (st->homed){
+        qsort(cycle, st->homed, sizeof cycle[0], cmp_time);
+        st->cycle_mean = total / st->homed;
+        st->cycle_p50 = percentile(cycle, st->homed, 50);
+        st->cycle_p95 = percentile(cycle, st->homed, 95);
+        st->cycle_p99 = percentile(cycle, st->homed, 99);
+        st->cycle_max = cycle[st->homed - 1] / 1e6;
+    }
+}
+
+void robot_report(double run_s){
+    struct robot_stats st;
+    double sense = 0, descend = 0, ret = 0;
+
+    robot_stats(&st);
+    for (int i = 0; i < next_bottle; i++){
+        const struct bottle *b = &bottles[i];
+        if (b->drop && b->home){
+            sense += (b->depart - b->load) / 1e6;
+            descend += (b->release - b->depart) / 1e6;
+            ret += (b->home - b->release) / 1e6;
+        }
+    }
+
+    fprintf(stdout, "bottles  fed %d (%d hung)  sorted %d  correct %d  wrong bin %d  in carriage %d  not fed %d\n",
+            st.fed, st.hung, st.sorted, st.correct, st.sorted - st.correct, carriage >= 0, num_bottles - st.fed);
+    fprintf(stdout, "rate     %.2f bottles/min over %.3f s run\n",
+            run_s > 0 ? st.sorted * 60.0 / run_s : 0.0, run_s);
+    if (st.homed){
+        fprintf(stdout, "cycle    mean %.0f ms  p50 %.0f  p95 %.0f  p99 %.0f  max %.0f ms  (load to home)\n",
+                st.cycle_mean, st.cycle_p50, st.cycle_p95, st.cycle_p99, st.cycle_max);
+        fprintf(stdout, "phases   sense %.0f ms  descend %.0f ms  return %.0f ms  (mean)\n",
+                sense / st.homed, descend / st.homed, ret / st.homed);
+    }
+    fprintf(stdout, "stepper  %lu steps  %lu lost  %lu phase errors  at %d  %u homing retries\n",
+            steps, lost_steps, phase_errors, pos, StepperRetries());
+    fprintf(stdout, "servo    %lu pulses  %lu bad  at %.0f us\n", servo_pulses, servo_bad_pulses, servo_us);
+    fprintf(stdout, "spinner  on %.1f s  %lu reversals  %lu shoot-through  peak %.2f  %lu spikes\n",
+            motor_on_ns / 1e9, motor_reversals, motor_shoot_through, motor_peak_i, motor_spikes);
+}
@@ -0,0 +1,109 @@
+/*
+ * File:   sim.h
+ *
+ * Internal interfaces of the host simulator. The firmware never includes
+ * this file; it only sees xc.h and its own driver headers.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include "xc.h"
+
+#include <stdint.h>
+
+#define SIM_FOSC    32000000UL
+
+//Virtual time in nanoseconds since reset
+typedef uint64_t sim_time_t;
+
+#define SIM_US      1000ULL
+#define SIM_MS      1000000ULL
+#define SIM_S       1000000000ULL
+#define SIM_NEVER   UINT64_MAX
+
+extern sim_time_t sim_now;
+
+//Timed callbacks. An event that is rescheduled before it fires replaces
+//the pending one, so components can keep a single handle per purpose.
+typedef void (*sim_event_fn)(void);
+void sim_at(sim_time_t t, sim_event_fn fn);
+void sim_cancel(sim_event_fn fn);
+
+void sim_elapse(sim_time_t ns);
+void sim_request_stop(const char *why);
+void sim_trace(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+extern int sim_tracing;
+
+//Deterministic pseudo random numbers
+uint32_t sim_rand(void);
+double sim_uniform(void);
+uint32_t sim_hash(uint32_t a, uint32_t b, uint32_t c);
+
+//Options shared by the components
+struct sim_options {
+    const char *bottles;
+    const char *keys;
+    const char *stop_text;
+    const char *eeprom_file;
+    const char *pc_out_file;
+    const char *pc_cmd;
+    unsigned pc_corrupt;
+    int uart;
+    const char *uart_cmd;
+    const char *rtc;
+    double max_time_s;
+    double loop_us;
+    unsigned seed;
+    double hang;
+    int home_offset;
+    sim_time_t stall_from, stall_to;
+    const char *json_file;
+    const char *name;
+};
+extern struct sim_options sim_opt;
+
+//Timer modules
+void timers_sample(void);
+
+//Robot: carriage, bin servo, centrifuge, sensors and bottle stream
+void robot_init(void);
+void robot_sample(void);
+void robot_run_start(void);
+void robot_report(double run_s);
+
+//Outcome of the bottle stream, cycle times are load to home in ms
+struct robot_stats {
+    int fed, sorted, correct, homed;
+    int hung;                   //fed bottles that hung in the hopper
+    double cycle_mean, cycle_p50, cycle_p95, cycle_p99, cycle_max;
+};
+void robot_stats(struct robot_stats *st);
+
+//HD44780 display on PORTD
+void lcd_sample(void);
+const char *lcd_row(int row);
+void lcd_report(void);
+
+//MSSP and the I2C bus with the DS1307 and the PC slave
+void i2c_init(void);
+void i2c_sample(void);
+void i2c_report(void);
+
+//EUSART, with the line on a pseudo terminal
+void uart_init(void);
+void uart_sample(void);
+void uart_report(void);
+
+//Data EEPROM
+void eeprom_init(void);
+void eeprom_sample(void);
+void eeprom_save(void);
+int eeprom_busy(void);
+void eeprom_report(void);
+
+//Firmware entry points
+void firmware_main(void);
+void keypressed(void);
+
+#endif /* SIM_H */
@@ -0,0 +1,131 @@
+/*
+ * File:   sim_eeprom.c
+ *
+ * The PIC18F4620's 1 KB data EEPROM behind EEADRH:EEADR, EEDATA, EECON1
+ * and EECON2, optionally loaded from and saved to an image file so logs
+ * survive between simulator runs. A write takes 4 ms and sets EEIF.
+ */
+
+#include "sim.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define EEPROM_SIZE     1024
+#define WRITE_NS        (4 * SIM_MS)
+#define POLL_NS         500     //Spinning on WR, a few instructions a pass
+
+volatile EECON1bits_t sim_eecon1;
+volatile unsigned char EEADR;
+volatile unsigned char EEADRH;
+volatile unsigned char EEDATA;
+
+static unsigned char eeprom[EEPROM_SIZE];
+static unsigned long reads, writes, unchanged_writes, refused_writes;
+
+static volatile unsigned short eecon2_slot = 0x8000;
+static int unlock;                  //0x55 then 0xAA seen, in that order
+static bool writing;
+static unsigned int write_addr;
+static unsigned char write_data;
+
+void eeprom_init(void){
+    memset(eeprom, 0xFF, sizeof eeprom);
+    if (sim_opt.eeprom_file){
+        FILE *f = fopen(sim_opt.eeprom_file, "rb");
+        if (f){
+            if (fread(eeprom, 1, sizeof eeprom, f) != sizeof eeprom){
+                fprintf(stderr, "robot-sim: %s is shorter than %d bytes\n", sim_opt.eeprom_file, EEPROM_SIZE);
+            }
+            fclose(f);
+        }
+    }
+}
+
+void eeprom_save(void){
+    if (!sim_opt.eeprom_file){
+        return;
+    }
+    FILE *f = fopen(sim_opt.eeprom_file, "wb");
+    if (!f || fwrite(eeprom, 1, sizeof eeprom, f) != sizeof eeprom){
+        fprintf(stderr, "robot-sim: cannot write %s\n", sim_opt.eeprom_file);
+    }
+    if (f){
+        fclose(f);
+    }
+}
+
+static unsigned int address(void){
+    return ((EEADRH << 8) | EEADR) & (EEPROM_SIZE - 1);
+}
+
+static void write_done(void){
+    writes++;
+    if (eeprom[write_addr] == write_data){
+        unchanged_writes++;
+    }
+    eeprom[write_addr] = write_data;
+    writing = false;
+    sim_eecon1.WR = 0;
+    PIR2bits.EEIF = 1;
+}
+
+//Acts on what the firmware has stored since the last access
+static void update(void){
+    if (!(eecon2_slot & 0x8000)){
+        unsigned char v = (unsigned char)eecon2_slot;
+        eecon2_slot = 0x8000;
+        unlock = (v == 0x55) ? 1 : (unlock == 1 && v == 0xAA) ? 2 : 0;
+    }
+    if (sim_eecon1.RD){
+        sim_eecon1.RD = 0;
+        if (!sim_eecon1.EEPGD && !sim_eecon1.CFGS){
+            reads++;
+            EEDATA = eeprom[address()];
+        }
+    }
+    if (sim_eecon1.WR && !writing){
+        if (!sim_eecon1.WREN || unlock != 2 || sim_eecon1.EEPGD || sim_eecon1.CFGS){
+            //The hardware ignores WR without the unlock sequence
+            refused_writes++;
+            sim_eecon1.WR = 0;
+        }
+        else {
+            writing = true;
+            write_addr = address();
+            write_data = EEDATA;
+            sim_at(sim_now + WRITE_NS, write_done);
+        }
+        unlock = 0;
+    }
+}
+
+volatile EECON1bits_t *sim_eecon1_access(void){
+    update();
+    if (writing){
+        sim_elapse(POLL_NS);
+    }
+    return &sim_eecon1;
+}
+
+volatile unsigned short *sim_eecon2(void){
+    update();
+    return &eecon2_slot;
+}
+
+void eeprom_sample(void){
+    update();
+}
+
+//A byte is being written, or the firmware is yet to start the next one
+int eeprom_busy(void){
+    return writing || (PIR2bits.EEIF && PIE2bits.EEIE);
+}
+
+void eeprom_report(void){
+    fprintf(stdout, "eeprom   %lu reads  %lu writes (%lu unchanged", reads, writes, unchanged_writes);
+    if (refused_writes){
+        fprintf(stdout, ", %lu refused", refused_writes);
+    }
+    fprintf(stdout, ")\n");
+}
@@ -0,0 +1,436 @@
+/*
+ * File:   sim_i2c.c
+ *
+ * MSSP in I2C master mode, with a simulated DS1307 at 0x68 and the PC
+ * interface slave at 0x08 on the bus. Each start, stop, byte and ACK the
+ * firmware starts takes bus time at the rate SSPADD selects, then clears
+ * its enable bit and raises SSPIF, as on the PIC. The DS1307's SQW/OUT
+ * pin drives RB2/INT2.
+ *
+ * The PC end of the log export is either a stand-in that takes every
+ * well-formed frame, or a receiver program (--pc-cmd, see pc/logrx.c)
+ * that is handed each write and asked for each read over a pipe:
+ *
+ *   W <seconds> <hex bytes>      bytes of one write transaction
+ *   R <seconds> <count>          answered with <count> hex bytes
+ */
+
+#include "sim.h"
+
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define DS1307_ADDR     0x68
+#define DS1307_CONTROL  0x07
+#define DS1307_OUT      0x80
+#define DS1307_SQWE     0x10
+#define PC_ADDR         0x08
+#define PC_BUF_SIZE     65536
+#define PC_FRAME_MAX    256
+#define PC_FRAME_NS     (1 * SIM_MS)    //The PC answers busy while it takes a frame
+#define PC_READY        0x01
+#define PC_BUSY         0x00
+
+enum { OP_NONE, OP_START, OP_RESTART, OP_STOP, OP_WRITE, OP_READ, OP_ACK };
+
+volatile SSPSTATbits_t sim_sspstat;
+volatile SSPCON1bits_t sim_sspcon1;
+volatile SSPCON2bits_t sim_sspcon2;
+volatile unsigned char SSPADD;
+
+static unsigned char sspbuf;
+static volatile unsigned short sspbuf_slot = 0x8000;
+
+static int op;
+static int expect_addr, device = -1, pointer_set;
+
+static unsigned char ds_ptr;
+static unsigned char ds_ram[64];
+static double ds_offset_s;  //DS1307 time minus virtual time, seconds since 1970
+static int sqw_high;
+static sim_time_t sqw_next;
+
+static unsigned char pc_buf[PC_BUF_SIZE];
+static unsigned long pc_len;
+static unsigned char pc_frame[PC_FRAME_MAX];
+static int pc_frame_len, pc_reading, pc_read_index;
+static unsigned char pc_reply[PC_FRAME_MAX];
+static unsigned char pc_next;       //Stand-in: the frame it wants next
+static sim_time_t pc_busy_until;
+static unsigned long pc_frames, pc_corrupted;
+static FILE *pc_to, *pc_from;       //Pipes to the receiver program
+static unsigned long transactions, bytes;
+
+static unsigned char to_bcd(int v){
+    return (unsigned char)(((v / 10) << 4) | (v % 10));
+}
+
+static int from_bcd(unsigned char v){
+    return (v >> 4) * 10 + (v & 0x0F);
+}
+
+//SQW at 1 Hz (RS1:RS0 = 00): high for the first half of each second, so
+//the seconds register ticks over on the rising edge
+static void sqw_edge(void){
+    sqw_high = !sqw_high;
+    PORTBbits.RB2 = sqw_high;
+    if (sqw_high == INTCON2bits.INTEDG2){
+        INTCON3bits.INT2IF = 1;
+    }
+    sqw_next += SIM_S / 2;
+    sim_at(sqw_next, sqw_edge);
+}
+
+//Restarts the square wave after the time or the control register changes
+static void sqw_restart(void){
+    sim_cancel(sqw_edge);
+    if (!(ds_ram[DS1307_CONTROL] & DS1307_SQWE) || (ds_ram[DS1307_CONTROL] & 0x03)){
+        //Other rates are not modelled, the pin then just follows OUT
+        sqw_high = (ds_ram[DS1307_CONTROL] & DS1307_OUT) != 0;
+        PORTBbits.RB2 = sqw_high;
+        return;
+    }
+    double halves = floor((ds_offset_s + sim_now / 1e9) * 2);
+    sqw_high = fmod(halves, 2) == 0;
+    PORTBbits.RB2 = sqw_high;
+    sqw_next = (sim_time_t)(((halves + 1) / 2 - ds_offset_s) * 1e9);
+    if (sqw_next <= sim_now){
+        sqw_next = sim_now + 1;
+    }
+    sim_at(sqw_next, sqw_edge);
+}
+
+static void ds_clock_regs(unsigned char regs[7]){
+    time_t t = (time_t)(ds_offset_s + sim_now / 1e9);
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    regs[0] = to_bcd(tm.tm_sec);
+    regs[1] = to_bcd(tm.tm_min);
+    regs[2] = to_bcd(tm.tm_hour);
+    regs[3] = (unsigned char)(tm.tm_wday + 1);
+    regs[4] = to_bcd(tm.tm_mday);
+    regs[5] = to_bcd(tm.tm_mon + 1);
+    regs[6] = to_bcd(tm.tm_year % 100);
+}
+
+static void ds_set_clock(const unsigned char regs[7]){
+    struct tm tm = {0};
+    tm.tm_sec = from_bcd(regs[0] & 0x7F);
+    tm.tm_min = from_bcd(regs[1]);
+    tm.tm_hour = from_bcd(regs[2] & 0x3F);
+    tm.tm_mday = from_bcd(regs[4]);
+    tm.tm_mon = from_bcd(regs[5]) - 1;
+    tm.tm_year = from_bcd(regs[6]) + 100;
+    ds_offset_s = (double)timegm(&tm) - sim_now / 1e9;
+    sqw_restart();
+}
+
+static unsigned char ds_read(void){
+    unsigned char v;
+    if (ds_ptr < 7){
+        unsigned char regs[7];
+        ds_clock_regs(regs);
+        v = regs[ds_ptr];
+    } else {
+        v = ds_ram[ds_ptr];
+    }
+    ds_ptr = (ds_ptr + 1) & 0x3F;
+    return v;
+}
+
+static void ds_write(unsigned char d){
+    if (ds_ptr < 7){
+        unsigned char regs[7];
+        ds_clock_regs(regs);
+        regs[ds_ptr] = d;
+        ds_set_clock(regs);
+    } else {
+        ds_ram[ds_ptr] = d;
+        if (ds_ptr == DS1307_CONTROL){
+            sqw_restart();
+        }
+    }
+    ds_ptr = (ds_ptr + 1) & 0x3F;
+}
+
+//Starts the receiver program with its stdin and stdout on pipes
+static void pc_spawn(const char *cmd){
+    int to[2], from[2];
+    if (pipe(to) || pipe(from)){
+        perror("robot-sim: pipe");
+        exit(2);
+    }
+    pid_t pid = fork();
+    if (pid < 0){
+        perror("robot-sim: fork");
+        exit(2);
+    }
+    if (pid == 0){
+        dup2(to[0], 0);
+        dup2(from[1], 1);
+        close(to[0]); close(to[1]); close(from[0]); close(from[1]);
+        execl("/bin/sh", "sh", "-c", cmd, (char *)0);
+        _exit(127);
+    }
+    close(to[0]);
+    close(from[1]);
+    pc_to = fdopen(to[1], "w");
+    pc_from = fdopen(from[0], "r");
+}
+
+//A write transaction to the PC has ended
+static void pc_frame_done(void){
+    if (pc_frame_len == 0){
+        return;
+    }
+    pc_frames++;
+    if (sim_opt.pc_corrupt && pc_frames % sim_opt.pc_corrupt == 0){
+        pc_frame[pc_frame_len / 2] ^= 0x10;
+        pc_corrupted++;
+    }
+    if (pc_to){
+        fprintf(pc_to, "W %.6f", sim_now / 1e9);
+        for (int i = 0; i < pc_frame_len; i++){
+            fprintf(pc_to, " %02x", pc_frame[i]);
+        }
+        fprintf(pc_to, "\n");
+        fflush(pc_to);
+    } else if (pc_frame_len >= 5 && pc_frame[0] == 0xA5 && pc_frame[3] + 5 == pc_frame_len &&
+               pc_frame[2] == pc_next){
+        pc_next++;
+    } else if (pc_frame_len >= 5 && pc_frame[1] == 'H'){
+        pc_next = 1;
+    }
+    pc_frame_len = 0;
+    pc_busy_until = sim_now + PC_FRAME_NS;
+}
+
+//Fills pc_reply at the start of a read from the PC
+static void pc_read_start(void){
+    pc_read_index = 0;
+    memset(pc_reply, 0, sizeof pc_reply);
+    if (sim_now < pc_busy_until){
+        pc_reply[0] = PC_BUSY;
+        return;
+    }
+    if (!pc_to){
+        pc_reply[0] = PC_READY;
+        pc_reply[1] = pc_next;
+        return;
+    }
+    fprintf(pc_to, "R %.6f %d\n", sim_now / 1e9, PC_FRAME_MAX);
+    fflush(pc_to);
+    char line[4 * PC_FRAME_MAX];
+    if (!fgets(line, sizeof line, pc_from)){
+        fprintf(stderr, "robot-sim: PC receiver closed its output\n");
+        fclose(pc_to);
+        pc_to = 0;
+        return;
+    }
+    char *p = line;
+    for (int i = 0; i < PC_FRAME_MAX; i++){
+        char *end;
+        unsigned long v = strtoul(p, &end, 16);
+        if (end == p){
+            break;
+        }
+        pc_reply[i] = (unsigned char)v;
+        p = end;
+    }
+}
+
+void i2c_init(void){
+    struct tm tm = {0};
+    if (sscanf(sim_opt.rtc, "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+               &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6){
+        fprintf(stderr, "robot-sim: bad --rtc time \"%s\"\n", sim_opt.rtc);
+        exit(2);
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    ds_offset_s = (double)timegm(&tm);
+    ds_ram[DS1307_CONTROL] = 0x03;  //Power-on value: OUT low, SQW off
+    sqw_restart();
+    if (sim_opt.pc_cmd){
+        pc_spawn(sim_opt.pc_cmd);
+    }
+}
+
+static unsigned long bus_hz(void){
+    return SIM_FOSC / (4 * ((unsigned long)SSPADD + 1));
+}
+
+//A byte clocked out by the master, returns whether a slave ACKs it
+static int slave_write(unsigned char d){
+    bytes++;
+    if (expect_addr){
+        expect_addr = 0;
+        device = d >> 1;
+        pointer_set = 0;
+        if (device != DS1307_ADDR && device != PC_ADDR){
+            device = -1;
+        }
+        pc_reading = device == PC_ADDR && (d & 1);
+        if (pc_reading){
+            pc_read_start();
+        }
+        return device >= 0;
+    }
+    if (device == DS1307_ADDR){
+        if (!pointer_set){
+            ds_ptr = d & 0x3F;
+            pointer_set = 1;
+        } else {
+            ds_write(d);
+        }
+    } else if (device == PC_ADDR){
+        if (pc_len < PC_BUF_SIZE){
+            pc_buf[pc_len++] = d;
+        }
+        if (pc_frame_len < PC_FRAME_MAX){
+            pc_frame[pc_frame_len++] = d;
+        }
+    }
+    return device >= 0;
+}
+
+static unsigned char slave_read(void){
+    bytes++;
+    if (device == DS1307_ADDR){
+        return ds_read();
+    }
+    if (device == PC_ADDR && pc_reading && pc_read_index < PC_FRAME_MAX){
+        return pc_reply[pc_read_index++];
+    }
+    return 0xFF;
+}
+
+static void op_done(void){
+    switch (op){
+        case OP_START:
+            SEN = 0;
+            expect_addr = 1;
+            transactions++;
+            break;
+        case OP_RESTART:
+            RSEN = 0;
+            expect_addr = 1;
+            break;
+        case OP_STOP:
+            PEN = 0;
+            if (device == PC_ADDR && !pc_reading){
+                pc_frame_done();
+            }
+            device = -1;
+            break;
+        case OP_WRITE:
+            SSPSTATbits.R_W = 0;
+            ACKSTAT = !slave_write(sspbuf);
+            break;
+        case OP_READ:
+            RCEN = 0;
+            sspbuf = slave_read();
+            SSPSTATbits.BF = 1;
+            break;
+        case OP_ACK:
+            ACKEN = 0;
+            break;
+    }
+    op = OP_NONE;
+    PIR1bits.SSPIF = 1;
+}
+
+static void op_start(int o, double bits){
+    op = o;
+    sim_at(sim_now + (sim_time_t)(bits * 1e9 / bus_hz()), op_done);
+}
+
+//Picks up a byte the firmware stored into the last SSPBUF slot
+static void check_write(void){
+    if (sspbuf_slot & 0x8000){
+        return;
+    }
+    sspbuf = (unsigned char)sspbuf_slot;
+    sspbuf_slot |= 0x8000;
+    if (!SSPCON1bits.SSPEN){
+        return;
+    }
+    if (op != OP_NONE){
+        SSPCON1bits.WCOL = 1;
+        return;
+    }
+    SSPSTATbits.R_W = 1;
+    op_start(OP_WRITE, 9);
+}
+
+volatile unsigned short *sim_sspbuf(void){
+    check_write();
+    SSPSTATbits.BF = 0;
+    sspbuf_slot = 0x8000 | sspbuf;
+    return &sspbuf_slot;
+}
+
+void i2c_sample(void){
+    check_write();
+    if (!SSPCON1bits.SSPEN){
+        if (op != OP_NONE){
+            sim_cancel(op_done);
+            op = OP_NONE;
+        }
+        device = -1;
+        return;
+    }
+    if (op != OP_NONE){
+        //The firmware clearing the bit it set (an MSSP reset) abandons it
+        static const unsigned char enable[] = { 0, 0x01, 0x02, 0x04, 0, 0x08, 0x10 };
+        if (enable[op] && !(SSPCON2 & enable[op])){
+            sim_cancel(op_done);
+            op = OP_NONE;
+            device = -1;
+        }
+        return;
+    }
+    if (SEN){
+        op_start(OP_START, 1);
+    } else if (RSEN){
+        op_start(OP_RESTART, 1.5);
+    } else if (PEN){
+        op_start(OP_STOP, 1);
+    } else if (RCEN){
+        op_start(OP_READ, 8);
+    } else if (ACKEN){
+        op_start(OP_ACK, 1);
+    }
+}
+
+void i2c_report(void){
+    fprintf(stdout, "i2c      %lu transactions  %lu bytes at %lu Hz  pc received %lu bytes in %lu writes",
+            transactions, bytes, bus_hz(), pc_len, pc_frames);
+    if (pc_corrupted){
+        fprintf(stdout, " (%lu corrupted)", pc_corrupted);
+    }
+    fprintf(stdout, "\n");
+    if (pc_to){
+        fclose(pc_to);      //The receiver reports when its input ends
+        pc_to = 0;
+        fclose(pc_from);
+        fflush(stdout);
+        while (wait(0) > 0){
+            continue;
+        }
+    }
+    if (sim_opt.pc_out_file){
+        FILE *f = fopen(sim_opt.pc_out_file, "wb");
+        if (!f || fwrite(pc_buf, 1, pc_len, f) != pc_len){
+            fprintf(stderr, "robot-sim: cannot write %s\n", sim_opt.pc_out_file);
+        }
+        if (f){
+            fclose(f);
+        }
+    }
+}
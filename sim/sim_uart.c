@@ -0,0 +1,198 @@
+/*
+ * File:   sim_uart.c
+ *
+ * EUSART in asynchronous mode, with the far end of the line on a Linux
+ * pseudo terminal (--uart) so a host program can talk to the firmware.
+ * Bytes take ten bit times at the rate SPBRGH:SPBRG selects, the receive
+ * FIFO is two deep and overruns set OERR, as on the PIC. While the pty is
+ * open the simulation is held to wall clock time.
+ */
+
+#define _GNU_SOURCE
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <time.h>
+
+#define IN_BUF_SIZE     4096
+
+volatile TXSTAbits_t sim_txsta = { .byte = 0x02 };     //TRMT set
+volatile RCSTAbits_t sim_rcsta;
+volatile BAUDCONbits_t sim_baudcon;
+volatile unsigned char SPBRG;
+volatile unsigned char SPBRGH;
+
+static int master = -1, slave = -1;
+static unsigned char txreg, tsr;
+static bool txreg_full, tsr_busy;
+static volatile unsigned short txreg_slot = 0x8000;
+static unsigned char rx_fifo[2];
+static int rx_count;
+static unsigned char in_buf[IN_BUF_SIZE];
+static int in_head, in_tail;
+static unsigned long sent, received, overruns;
+static struct timespec wall_start;
+
+static unsigned long baud(void){
+    unsigned long n = ((unsigned long)SPBRGH << 8) | SPBRG;
+    unsigned long div = BAUDCONbits.BRG16 ? (TXSTAbits.BRGH ? 4 : 16) : (TXSTAbits.BRGH ? 16 : 64);
+    if (!BAUDCONbits.BRG16){
+        n &= 0xFF;
+    }
+    return SIM_FOSC / (div * (n + 1));
+}
+
+static sim_time_t byte_time(void){
+    return 10 * 1000000000ULL / baud();
+}
+
+static void tx_done(void){
+    if (master >= 0 && write(master, &tsr, 1) != 1){
+        //Nobody reading the pty, the byte is lost as on an open line
+    }
+    sent++;
+    if (txreg_full){
+        tsr = txreg;
+        txreg_full = false;
+        PIR1bits.TXIF = 1;
+        sim_at(sim_now + byte_time(), tx_done);
+    } else {
+        tsr_busy = false;
+        TXSTAbits.TRMT = 1;
+    }
+}
+
+//Picks up a byte the firmware stored into the last TXREG slot
+static void check_write(void){
+    if (txreg_slot & 0x8000){
+        return;
+    }
+    unsigned char v = (unsigned char)txreg_slot;
+    txreg_slot |= 0x8000;
+    if (!RCSTAbits.SPEN || !TXSTAbits.TXEN){
+        return;
+    }
+    if (!tsr_busy){
+        tsr = v;
+        tsr_busy = true;
+        TXSTAbits.TRMT = 0;
+        sim_at(sim_now + byte_time(), tx_done);
+    } else if (!txreg_full){
+        txreg = v;
+        txreg_full = true;
+        PIR1bits.TXIF = 0;
+    }
+}
+
+volatile unsigned short *sim_txreg(void){
+    check_write();
+    txreg_slot = 0x8000 | txreg;
+    return &txreg_slot;
+}
+
+volatile RCSTAbits_t *sim_rcsta_access(void){
+    if (!sim_rcsta.CREN){
+        sim_rcsta.OERR = 0;
+    }
+    return &sim_rcsta;
+}
+
+unsigned char sim_rcreg(void){
+    unsigned char v = rx_fifo[0];
+    if (rx_count){
+        rx_fifo[0] = rx_fifo[1];
+        rx_count--;
+    }
+    PIR1bits.RCIF = rx_count > 0;
+    return v;
+}
+
+//Keeps virtual time from running ahead of the wall clock
+static void pace(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double wall = (now.tv_sec - wall_start.tv_sec) + (now.tv_nsec - wall_start.tv_nsec) / 1e9;
+    double ahead = sim_now / 1e9 - wall;
+    if (ahead > 0.002){
+        usleep((useconds_t)(ahead * 1e6));
+    }
+}
+
+//Runs once per byte time: takes what the host sent and shifts one byte in
+static void rx_poll(void){
+    unsigned char b[256];
+    ssize_t n = read(master, b, sizeof b);
+    for (ssize_t i = 0; i < n; i++){
+        int next = (in_head + 1) % IN_BUF_SIZE;
+        if (next != in_tail){
+            in_buf[in_head] = b[i];
+            in_head = next;
+        }
+    }
+    if (in_head != in_tail && RCSTAbits.SPEN && RCSTAbits.CREN){
+        if (rx_count < 2 && !RCSTAbits.OERR){
+            rx_fifo[rx_count++] = in_buf[in_tail];
+            PIR1bits.RCIF = 1;
+            received++;
+        } else {
+            RCSTAbits.OERR = 1;
+            overruns++;
+        }
+        in_tail = (in_tail + 1) % IN_BUF_SIZE;
+    }
+    pace();
+    sim_at(sim_now + (RCSTAbits.SPEN ? byte_time() : SIM_MS), rx_poll);
+}
+
+void uart_init(void){
+    if (!sim_opt.uart){
+        return;
+    }
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) || unlockpt(master)){
+        perror("robot-sim: pty");
+        exit(2);
+    }
+    const char *name = ptsname(master);
+    //Hold the slave open in raw mode, so nothing echoes before the host
+    //program opens it and reads keep working after it closes
+    slave = open(name, O_RDWR | O_NOCTTY);
+    struct termios tio;
+    if (slave < 0 || tcgetattr(slave, &tio)){
+        perror(name);
+        exit(2);
+    }
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    fcntl(master, F_SETFL, O_NONBLOCK);
+    setenv("ROBOT_TTY", name, 1);
+    fprintf(stderr, "robot-sim: uart on %s\n", name);
+
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    sim_at(sim_now + SIM_MS, rx_poll);
+    if (sim_opt.uart_cmd){
+        if (fork() == 0){
+            execl("/bin/sh", "sh", "-c", sim_opt.uart_cmd, (char *)0);
+            _exit(127);
+        }
+    }
+}
+
+void uart_sample(void){
+    check_write();
+    if (RCSTAbits.SPEN && TXSTAbits.TXEN && !txreg_full){
+        PIR1bits.TXIF = 1;
+    }
+}
+
+void uart_report(void){
+    if (sent || received){
+        fprintf(stdout, "uart     %lu bytes sent  %lu received  %lu overruns at %lu baud\n",
+                sent, received, overruns, baud());
+    }
+}
@@ -0,0 +1,124 @@
+/*
+ * File:   timers.c
+ *
+ * PIC18 timer modules. A running timer is not stepped count by count: its
+ * count follows from virtual time, is written back to the TMRx registers
+ * whenever the outputs are sampled so the firmware reads a live value, and
+ * its overflow is a timed event. A register value other than the one the
+ * simulator last stored is a firmware write and restarts the count there.
+ */
+
+#include "sim.h"
+
+struct timer {
+    volatile unsigned char *lo, *hi;    //hi is 0 for an 8-bit timer
+    sim_event_fn overflow;
+    int on;
+    unsigned config;
+    sim_time_t tick_ns, base_t;
+    unsigned top, base_count, stored;
+};
+
+static unsigned timer_get(struct timer *t){
+    return t->hi ? (unsigned)(*t->hi << 8 | *t->lo) : *t->lo;
+}
+
+static void timer_put(struct timer *t, unsigned v){
+    *t->lo = (unsigned char)v;
+    if (t->hi){
+        *t->hi = (unsigned char)(v >> 8);
+    }
+    t->stored = v;
+}
+
+static void timer_schedule(struct timer *t){
+    sim_at(t->base_t + (t->top - t->base_count) * t->tick_ns, t->overflow);
+}
+
+//Restarts the count from zero after an overflow; the caller sets the flag
+static void timer_wrap(struct timer *t){
+    t->base_t = sim_now;
+    t->base_count = 0;
+    timer_put(t, 0);
+    timer_schedule(t);
+}
+
+static void timer_sample(struct timer *t, int on, unsigned config, sim_time_t tick_ns, int sixteen_bit){
+    if (!on){
+        if (t->on){
+            t->on = 0;
+            sim_cancel(t->overflow);
+        }
+        return;
+    }
+    if (!sixteen_bit){
+        t->hi = 0;
+    }
+    unsigned reg = timer_get(t);
+    if (!t->on || config != t->config || reg != t->stored){
+        t->on = 1;
+        t->config = config;
+        t->tick_ns = tick_ns;
+        t->top = sixteen_bit ? 0x10000 : 0x100;
+        t->base_t = sim_now;
+        t->base_count = reg;
+        t->stored = reg;
+        timer_schedule(t);
+        return;
+    }
+    unsigned count = t->base_count + (unsigned)((sim_now - t->base_t) / t->tick_ns);
+    timer_put(t, count < t->top ? count : t->top - 1);
+}
+
+//Timer0: scheduler tick
+static void tmr0_overflow(void);
+static struct timer tmr0 = { &TMR0L, &TMR0H, tmr0_overflow };
+
+static void tmr0_overflow(void){
+    INTCONbits.TMR0IF = 1;
+    timer_wrap(&tmr0);
+}
+
+static void sample_tmr0(void){
+    //Only the instruction clock is modelled, not T0CKI
+    unsigned prescale = T0CONbits.PSA ? 1 : 2u << (T0CON & 0x07);
+    tmr0.hi = &TMR0H;
+    timer_sample(&tmr0, T0CONbits.TMR0ON && !T0CONbits.T0CS, T0CON,
+                 4 * SIM_S / SIM_FOSC * prescale, !T0CONbits.T08BIT);
+}
+
+//Timer1: stepper step timing
+static void tmr1_overflow(void);
+static struct timer tmr1 = { &TMR1L, &TMR1H, tmr1_overflow };
+
+static void tmr1_overflow(void){
+    PIR1bits.TMR1IF = 1;
+    timer_wrap(&tmr1);
+}
+
+static void sample_tmr1(void){
+    unsigned prescale = 1u << ((T1CON >> 4) & 0x03);
+    timer_sample(&tmr1, T1CONbits.TMR1ON && !T1CONbits.TMR1CS, T1CON,
+                 4 * SIM_S / SIM_FOSC * prescale, 1);
+}
+
+//Timer3: bin servo pulses
+static void tmr3_overflow(void);
+static struct timer tmr3 = { &TMR3L, &TMR3H, tmr3_overflow };
+
+static void tmr3_overflow(void){
+    PIR2bits.TMR3IF = 1;
+    timer_wrap(&tmr3);
+}
+
+static void sample_tmr3(void){
+    unsigned prescale = 1u << ((T3CON >> 4) & 0x03);
+    timer_sample(&tmr3, T3CONbits.TMR3ON && !T3CONbits.TMR3CS, T3CON,
+                 4 * SIM_S / SIM_FOSC * prescale, 1);
+}
+
+void timers_sample(void){
+    sample_tmr0();
+    sample_tmr1();
+    sample_tmr3();
+}
@@ -0,0 +1,267 @@
+/*
+ * File:   xc.h (host simulator)
+ *
+ * Stand-in for the XC8 device header when the firmware is built for Linux.
+ * Every special function register the firmware touches is an ordinary
+ * global here; sim/pic18_sim.c samples the outputs and drives the inputs
+ * of the simulated robot whenever virtual time advances.
+ */
+
+#ifndef SIM_XC_H
+#define SIM_XC_H
+
+#include <stdbool.h>
+
+#define SIM_BITS8(b0,b1,b2,b3,b4,b5,b6,b7) \
+    struct { unsigned b0:1; unsigned b1:1; unsigned b2:1; unsigned b3:1; \
+             unsigned b4:1; unsigned b5:1; unsigned b6:1; unsigned b7:1; }
+
+//An 8-bit register with named bits. XC8 also lets single bits be used on
+//their own (GIE, LATC0, ...); those are macros expanding to var.BIT, and
+//the bit struct is repeated under the variable's own name so that
+//REGbits.BIT, which then expands to var.var.BIT, still resolves.
+#define SIM_REG(type, var, ...) \
+    typedef union { unsigned char byte; SIM_BITS8(__VA_ARGS__); SIM_BITS8(__VA_ARGS__) var; } type; \
+    extern volatile type var;
+
+//Ports
+SIM_REG(PORTAbits_t, sim_porta, RA0,RA1,RA2,RA3,RA4,RA5,RA6,RA7)
+SIM_REG(PORTBbits_t, sim_portb, RB0,RB1,RB2,RB3,RB4,RB5,RB6,RB7)
+SIM_REG(PORTCbits_t, sim_portc, RC0,RC1,RC2,RC3,RC4,RC5,RC6,RC7)
+SIM_REG(PORTDbits_t, sim_portd, RD0,RD1,RD2,RD3,RD4,RD5,RD6,RD7)
+SIM_REG(PORTEbits_t, sim_porte, RE0,RE1,RE2,RE3,RE4,RE5,RE6,RE7)
+
+//Output latches also answer to the short LCx style names
+#define SIM_LAT(type, var, p, q) \
+    typedef union { unsigned char byte; \
+        SIM_BITS8(p##0,p##1,p##2,p##3,p##4,p##5,p##6,p##7); \
+        SIM_BITS8(q##0,q##1,q##2,q##3,q##4,q##5,q##6,q##7); \
+        SIM_BITS8(p##0,p##1,p##2,p##3,p##4,p##5,p##6,p##7) var; } type; \
+    extern volatile type var;
+
+SIM_LAT(LATAbits_t, sim_lata, LATA, LA)
+SIM_LAT(LATBbits_t, sim_latb, LATB, LB)
+SIM_LAT(LATCbits_t, sim_latc, LATC, LC)
+SIM_LAT(LATDbits_t, sim_latd, LATD, LD)
+SIM_LAT(LATEbits_t, sim_late, LATE, LE)
+
+SIM_REG(TRISAbits_t, sim_trisa, TRISA0,TRISA1,TRISA2,TRISA3,TRISA4,TRISA5,TRISA6,TRISA7)
+SIM_REG(TRISBbits_t, sim_trisb, TRISB0,TRISB1,TRISB2,TRISB3,TRISB4,TRISB5,TRISB6,TRISB7)
+SIM_REG(TRISCbits_t, sim_trisc, TRISC0,TRISC1,TRISC2,TRISC3,TRISC4,TRISC5,TRISC6,TRISC7)
+SIM_REG(TRISDbits_t, sim_trisd, TRISD0,TRISD1,TRISD2,TRISD3,TRISD4,TRISD5,TRISD6,TRISD7)
+SIM_REG(TRISEbits_t, sim_trise, TRISE0,TRISE1,TRISE2,TRISE3,TRISE4,TRISE5,TRISE6,TRISE7)
+
+#define PORTA       sim_porta.byte
+#define PORTB       sim_portb.byte
+#define PORTC       sim_portc.byte
+#define PORTD       sim_portd.byte
+#define PORTE       sim_porte.byte
+#define PORTAbits   sim_porta
+#define PORTBbits   sim_portb
+#define PORTCbits   sim_portc
+#define PORTDbits   sim_portd
+#define PORTEbits   sim_porte
+#define LATA        sim_lata.byte
+#define LATB        sim_latb.byte
+#define LATC        sim_latc.byte
+#define LATD        sim_latd.byte
+#define LATE        sim_late.byte
+#define LATAbits    sim_lata
+#define LATBbits    sim_latb
+#define LATCbits    sim_latc
+#define LATDbits    sim_latd
+#define LATEbits    sim_late
+#define TRISA       sim_trisa.byte
+#define TRISB       sim_trisb.byte
+#define TRISC       sim_trisc.byte
+#define TRISD       sim_trisd.byte
+#define TRISE       sim_trise.byte
+#define TRISAbits   sim_trisa
+#define TRISBbits   sim_trisb
+#define TRISCbits   sim_trisc
+#define TRISDbits   sim_trisd
+#define TRISEbits   sim_trise
+
+#define LATC0       sim_latc.LATC0
+#define TRISC3      sim_trisc.TRISC3
+#define TRISC4      sim_trisc.TRISC4
+
+//Interrupt control
+SIM_REG(INTCONbits_t, sim_intcon, RBIF,INT0IF,TMR0IF,RBIE,INT0IE,TMR0IE,PEIE,GIE)
+SIM_REG(INTCON2bits_t, sim_intcon2, RBIP,INT3IP,TMR0IP,INTEDG3,INTEDG2,INTEDG1,INTEDG0,NOT_RBPU)
+SIM_REG(INTCON3bits_t, sim_intcon3, INT1IF,INT2IF,INT3IF,INT1IE,INT2IE,INT3IE,INT1IP,INT2IP)
+SIM_REG(PIR1bits_t, sim_pir1, TMR1IF,TMR2IF,CCP1IF,SSPIF,TXIF,RCIF,ADIF,PSPIF)
+SIM_REG(PIE1bits_t, sim_pie1, TMR1IE,TMR2IE,CCP1IE,SSPIE,TXIE,RCIE,ADIE,PSPIE)
+SIM_REG(PIR2bits_t, sim_pir2, CCP2IF,TMR3IF,HLVDIF,BCLIF,EEIF,PIR2_5,PIR2_6,OSCFIF)
+SIM_REG(PIE2bits_t, sim_pie2, CCP2IE,TMR3IE,HLVDIE,BCLIE,EEIE,PIE2_5,PIE2_6,OSCFIE)
+SIM_REG(RCONbits_t, sim_rcon, NOT_BOR,NOT_POR,NOT_PD,NOT_TO,NOT_RI,RCON_5,SBOREN,IPEN)
+
+#define INTCON      sim_intcon.byte
+#define INTCON2     sim_intcon2.byte
+#define INTCON3     sim_intcon3.byte
+#define PIR1        sim_pir1.byte
+#define PIE1        sim_pie1.byte
+#define PIR2        sim_pir2.byte
+#define PIE2        sim_pie2.byte
+#define RCON        sim_rcon.byte
+#define INTCONbits  sim_intcon
+#define INTCON2bits sim_intcon2
+#define INTCON3bits sim_intcon3
+#define PIR1bits    sim_pir1
+#define PIE1bits    sim_pie1
+#define PIR2bits    sim_pir2
+#define PIE2bits    sim_pie2
+#define RCONbits    sim_rcon
+
+#define GIE         sim_intcon.GIE
+#define PEIE        sim_intcon.PEIE
+#define TMR0IE      sim_intcon.TMR0IE
+#define TMR0IF      sim_intcon.TMR0IF
+#define INT0IE      sim_intcon.INT0IE
+#define INT0IF      sim_intcon.INT0IF
+#define INT1IE      sim_intcon3.INT1IE
+#define INT1IF      sim_intcon3.INT1IF
+#define INT2IE      sim_intcon3.INT2IE
+#define INT2IF      sim_intcon3.INT2IF
+#define INTEDG2     sim_intcon2.INTEDG2
+#define TMR1IE      sim_pie1.TMR1IE
+#define TMR1IF      sim_pir1.TMR1IF
+#define TMR2IE      sim_pie1.TMR2IE
+#define TMR2IF      sim_pir1.TMR2IF
+#define SSPIE       sim_pie1.SSPIE
+#define SSPIF       sim_pir1.SSPIF
+#define BCLIE       sim_pie2.BCLIE
+#define BCLIF       sim_pir2.BCLIF
+#define TMR3IE      sim_pie2.TMR3IE
+#define TMR3IF      sim_pir2.TMR3IF
+#define EEIE        sim_pie2.EEIE
+#define EEIF        sim_pir2.EEIF
+
+#define ei()        (INTCONbits.GIE = 1)
+#define di()        (INTCONbits.GIE = 0)
+
+//Timer0
+SIM_REG(T0CONbits_t, sim_t0con, T0PS0,T0PS1,T0PS2,PSA,T0SE,T0CS,T08BIT,TMR0ON)
+#define T0CON       sim_t0con.byte
+#define T0CONbits   sim_t0con
+extern volatile unsigned char TMR0L;
+extern volatile unsigned char TMR0H;
+
+//Timer1
+SIM_REG(T1CONbits_t, sim_t1con, TMR1ON,TMR1CS,NOT_T1SYNC,T1OSCEN,T1CKPS0,T1CKPS1,T1RUN,RD16)
+#define T1CON       sim_t1con.byte
+#define T1CONbits   sim_t1con
+#define TMR1ON      sim_t1con.TMR1ON
+extern volatile unsigned char TMR1L;
+extern volatile unsigned char TMR1H;
+
+//Timer2 and the CCP modules. Timer2 only clocks the PWM, which robot.c
+//reads back from the duty registers rather than the pins.
+SIM_REG(T2CONbits_t, sim_t2con, T2CKPS0,T2CKPS1,TMR2ON,T2OUTPS0,T2OUTPS1,T2OUTPS2,T2OUTPS3,T2CON_7)
+#define T2CON       sim_t2con.byte
+#define T2CONbits   sim_t2con
+#define TMR2ON      sim_t2con.TMR2ON
+extern volatile unsigned char TMR2;
+extern volatile unsigned char PR2;
+SIM_REG(CCP1CONbits_t, sim_ccp1con, CCP1M0,CCP1M1,CCP1M2,CCP1M3,DC1B0,DC1B1,P1M0,P1M1)
+#define CCP1CON     sim_ccp1con.byte
+#define CCP1CONbits sim_ccp1con
+extern volatile unsigned char CCPR1L;
+SIM_REG(CCP2CONbits_t, sim_ccp2con, CCP2M0,CCP2M1,CCP2M2,CCP2M3,DC2B0,DC2B1,CCP2CON_6,CCP2CON_7)
+#define CCP2CON     sim_ccp2con.byte
+#define CCP2CONbits sim_ccp2con
+extern volatile unsigned char CCPR2L;
+
+//Timer3
+SIM_REG(T3CONbits_t, sim_t3con, TMR3ON,TMR3CS,NOT_T3SYNC,T3CCP1,T3CKPS0,T3CKPS1,T3CCP2,RD16)
+#define T3CON       sim_t3con.byte
+#define T3CONbits   sim_t3con
+#define TMR3ON      sim_t3con.TMR3ON
+extern volatile unsigned char TMR3L;
+extern volatile unsigned char TMR3H;
+
+//MSSP in I2C master mode
+SIM_REG(SSPSTATbits_t, sim_sspstat, BF,UA,R_W,S,P,D_A,CKE,SMP)
+SIM_REG(SSPCON1bits_t, sim_sspcon1, SSPM0,SSPM1,SSPM2,SSPM3,CKP,SSPEN,SSPOV,WCOL)
+SIM_REG(SSPCON2bits_t, sim_sspcon2, SEN,RSEN,PEN,RCEN,ACKEN,ACKDT,ACKSTAT,GCEN)
+#define SSPSTAT     sim_sspstat.byte
+#define SSPCON1     sim_sspcon1.byte
+#define SSPCON2     sim_sspcon2.byte
+#define SSPSTATbits sim_sspstat
+#define SSPCON1bits sim_sspcon1
+#define SSPCON2bits sim_sspcon2
+#define SEN         sim_sspcon2.SEN
+#define RSEN        sim_sspcon2.RSEN
+#define PEN         sim_sspcon2.PEN
+#define RCEN        sim_sspcon2.RCEN
+#define ACKEN       sim_sspcon2.ACKEN
+#define ACKDT       sim_sspcon2.ACKDT
+#define ACKSTAT     sim_sspcon2.ACKSTAT
+extern volatile unsigned char SSPADD;
+
+//A write to SSPBUF starts a transfer even when it repeats the last value,
+//so it has to be seen as an access. Every use of SSPBUF fetches a fresh
+//16-bit slot holding 0x8000 | SSPBUF: a read truncates to the register
+//value, a byte stored into it clears bit 15, which sim_i2c.c picks up as
+//a write. Only plain assignments to and from SSPBUF work this way.
+volatile unsigned short *sim_sspbuf(void);
+#define SSPBUF      (*sim_sspbuf())
+
+//Data EEPROM. RD and WR act on the next access to EECON1 after they are
+//set, and EECON2 uses the same slot scheme as SSPBUF so the 0x55, 0xAA
+//unlock sequence is seen write by write.
+SIM_REG(EECON1bits_t, sim_eecon1, RD,WR,WREN,WRERR,FREE,EECON1_5,CFGS,EEPGD)
+volatile EECON1bits_t *sim_eecon1_access(void);
+volatile unsigned short *sim_eecon2(void);
+#define EECON1bits  (*sim_eecon1_access())
+#define EECON1      (sim_eecon1_access()->byte)
+#define EECON2      (*sim_eecon2())
+extern volatile unsigned char EEADR;
+extern volatile unsigned char EEADRH;
+extern volatile unsigned char EEDATA;
+
+//EUSART. TXREG uses the SSPBUF slot scheme; reading RCREG pops the
+//receive FIFO. Every access to RCSTA first clears OERR if CREN was left
+//clear, so cycling CREN resets an overrun as on the PIC.
+SIM_REG(TXSTAbits_t, sim_txsta, TX9D,TRMT,BRGH,SENDB,SYNC,TXEN,TX9,CSRC)
+SIM_REG(RCSTAbits_t, sim_rcsta, RX9D,OERR,FERR,ADDEN,CREN,SREN,RX9,SPEN)
+SIM_REG(BAUDCONbits_t, sim_baudcon, ABDEN,WUE,BAUDCON_2,BRG16,TXCKP,BAUDCON_5,RCIDL,ABDOVF)
+#define TXSTA       sim_txsta.byte
+#define RCSTA       (sim_rcsta_access()->byte)
+#define BAUDCON     sim_baudcon.byte
+#define TXSTAbits   sim_txsta
+#define RCSTAbits   (*sim_rcsta_access())
+#define BAUDCONbits sim_baudcon
+extern volatile unsigned char SPBRG;
+extern volatile unsigned char SPBRGH;
+volatile RCSTAbits_t *sim_rcsta_access(void);
+volatile unsigned short *sim_txreg(void);
+unsigned char sim_rcreg(void);
+#define TXREG       (*sim_txreg())
+#define RCREG       sim_rcreg()
+
+//Oscillator and ADC, written once at start-up and otherwise ignored
+SIM_REG(OSCTUNEbits_t, sim_osctune, TUN0,TUN1,TUN2,TUN3,TUN4,OSCTUNE_5,PLLEN,INTSRC)
+#define OSCTUNE     sim_osctune.byte
+#define OSCTUNEbits sim_osctune
+
+extern volatile unsigned char OSCCON;
+extern volatile unsigned char ADCON0;
+extern volatile unsigned char ADCON1;
+
+//The firmware is built as a hosted program: the ISR is a plain function
+//that the simulator calls, and main() is renamed by the Makefile.
+#define interrupt
+#define NOP()       ((void)0)
+#define CLRWDT()    ((void)0)
+
+//Delays advance the virtual clock instead of spinning
+void sim_delay_ns(unsigned long long ns);
+#define __delay_us(x)   sim_delay_ns((unsigned long long)(x) * 1000ULL)
+#define __delay_ms(x)   sim_delay_ns((unsigned long long)(x) * 1000000ULL)
+
+//Called once per pass of the firmware main loop (see constants.h)
+void sim_loop_idle(void);
+#define __loop_idle()   sim_loop_idle()
+
+#endif /* SIM_XC_H */
@@ -7,6 +7,24 @@
 #include "I2C.h"
 #include "configBits.h"
 
+//Where the transaction at the head of the queue is. Each phase is entered
+//when the MSSP raises SSPIF for the step before it.
+#define PH_START        0
+#define PH_ADDR         1
+#define PH_REG          2
+#define PH_RESTART      3
+#define PH_ADDR_READ    4
+#define PH_WRITE        5
+#define PH_READ         6
+#define PH_ACK          7
+#define PH_STOP         8
+
+static i2c_txn_t *queue[I2C_QUEUE_LEN];
+static volatile unsigned char head, tail;
+static i2c_txn_t * volatile current;
+static unsigned char phase, count, result;
+static volatile unsigned char elapsed_ms;
+
 void I2C_Master_Init(const unsigned long c)
 {
   // See Datasheet pg171, I2C mode configuration
@@ -16,52 +34,190 @@ void I2C_Master_Init(const unsigned long c)
   SSPADD = (_XTAL_FREQ/(4*c))-1;
   TRISC3 = 1;        //Setting as input as given in datasheet
   TRISC4 = 1;        //Setting as input as given in datasheet
+
+  head = 0;
+  tail = 0;
+  current = 0;
+  SSPIF = 0;
+  BCLIF = 0;
+  SSPIE = 1;
+  BCLIE = 1;
+  PEIE = 1;
 }
 
-void I2C_Master_Wait()
+//Puts the next queued transaction on the bus, if the bus is free
+static void StartNext(void)
 {
-  while ((SSPSTAT & 0x04) || (SSPCON2 & 0x1F));
+  if (current || head == tail){
+    return;
+  }
+  current = queue[tail];
+  tail = (tail + 1) % I2C_QUEUE_LEN;
+  count = 0;
+  elapsed_ms = 0;
+  phase = PH_START;
+  SEN = 1;
 }
 
-void I2C_Master_Start()
+static void Stop(unsigned char r)
 {
-  I2C_Master_Wait();
-  SEN = 1;
+  result = r;
+  phase = PH_STOP;
+  PEN = 1;
 }
 
-void I2C_Master_RepeatedStart()
+static void WriteNext(void)
 {
-  I2C_Master_Wait();
-  RSEN = 1;
+  if (count < current->len){
+    SSPBUF = current->buf[count++];
+    phase = PH_WRITE;
+  } else {
+    Stop(I2C_DONE);
+  }
 }
 
-void I2C_Master_Stop()
+static void Finish(unsigned char r)
 {
-  I2C_Master_Wait();
-  PEN = 1;
+  current->status = r;
+  current = 0;
+  StartNext();
 }
 
-void I2C_Master_Write(unsigned d)
+//! @brief      Queues a transaction, the MSSP interrupt carries it out.
+//! @returns    false if the queue is full.
+bool I2C_Submit(i2c_txn_t *t)
 {
-  I2C_Master_Wait();
-  SSPBUF = d;
+  bool gie = GIE;
+  bool ok = false;
+  di();
+  if ((head + 1) % I2C_QUEUE_LEN != tail){
+    t->status = I2C_BUSY;
+    queue[head] = t;
+    head = (head + 1) % I2C_QUEUE_LEN;
+    StartNext();
+    ok = true;
+  }
+  if (gie){
+    ei();
+  }
+  return ok;
 }
 
-unsigned char I2C_Master_Read(unsigned char a)
+//! @brief      Queues a transaction and waits for it. For the RTC reads and
+//!             writes of the main loop, with interrupts on: the ISR moves
+//!             the transaction on and the Timer0 tick times it out.
+//! @returns    true if the transaction completed.
+bool I2C_Transfer(i2c_txn_t *t)
 {
-  unsigned char temp;
-  I2C_Master_Wait();
-  RCEN = 1;
-  I2C_Master_Wait();
-  temp = SSPBUF;
-  I2C_Master_Wait();
-  ACKDT = (a)?0:1;
-  ACKEN = 1;
-  return temp;
+  if (!I2C_Submit(t)){
+    return false;
+  }
+  while (t->status == I2C_BUSY){
+    __delay_us(10);
+  }
+  return t->status == I2C_DONE;
+}
+
+//! @brief      Advances the current transaction, called on SSPIF or BCLIF.
+void I2C_ISR(void)
+{
+  if (BCLIF){
+    //Lost arbitration or SDA held low, the MSSP is already idle
+    BCLIF = 0;
+    SSPIF = 0;
+    if (current){
+      Finish(I2C_FAILED);
+    }
+    return;
+  }
+  SSPIF = 0;
+  if (!current){
+    return;
+  }
+  switch (phase){
+    case PH_START:
+      SSPBUF = (unsigned char)(current->addr << 1) | (current->no_reg && current->read);
+      phase = PH_ADDR;
+      break;
+    case PH_ADDR:
+      if (ACKSTAT){
+        Stop(I2C_FAILED);
+      } else if (!current->no_reg){
+        SSPBUF = current->reg;
+        phase = PH_REG;
+      } else if (current->read){
+        RCEN = 1;
+        phase = PH_READ;
+      } else {
+        WriteNext();
+      }
+      break;
+    case PH_REG:
+      if (ACKSTAT){
+        Stop(I2C_FAILED);
+      } else if (current->read){
+        RSEN = 1;
+        phase = PH_RESTART;
+      } else {
+        WriteNext();
+      }
+      break;
+    case PH_RESTART:
+      SSPBUF = (unsigned char)(current->addr << 1) | 1;
+      phase = PH_ADDR_READ;
+      break;
+    case PH_ADDR_READ:
+      if (ACKSTAT){
+        Stop(I2C_FAILED);
+      } else {
+        RCEN = 1;
+        phase = PH_READ;
+      }
+      break;
+    case PH_WRITE:
+      if (ACKSTAT){
+        Stop(I2C_FAILED);
+      } else {
+        WriteNext();
+      }
+      break;
+    case PH_READ:
+      current->buf[count++] = SSPBUF;
+      ACKDT = (count == current->len);    //NACK the last byte
+      ACKEN = 1;
+      phase = PH_ACK;
+      break;
+    case PH_ACK:
+      if (count < current->len){
+        RCEN = 1;
+        phase = PH_READ;
+      } else {
+        Stop(I2C_DONE);
+      }
+      break;
+    case PH_STOP:
+      Finish(result);
+      break;
+  }
+}
+
+//! @brief      Times out a stuck transaction, called from the 1 ms tick.
+//!             Resetting the MSSP releases the bus; the next transaction
+//!             then starts with a fresh start condition.
+void I2C_Tick(void)
+{
+  if (!current || ++elapsed_ms < I2C_TIMEOUT_MS){
+    return;
+  }
+  SSPCON1bits.SSPEN = 0;
+  SSPCON2 = 0b00000000;
+  SSPCON1bits.SSPEN = 1;
+  SSPIF = 0;
+  Finish(I2C_FAILED);
 }
 
 void delay_10ms(unsigned char n) { 
     while (n-- != 0) { 
         __delay_ms(5); 
     } 
-}
\ No newline at end of file
+}
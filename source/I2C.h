@@ -1,3 +1,40 @@
+/*
+ * File:   I2C.h
+ */
+
+#ifndef I2C_H
+#define	I2C_H
+
+#include <stdbool.h>
+
+#define I2C_QUEUE_LEN       4
+#define I2C_TIMEOUT_MS      20      //A transaction still running after this is aborted
+
+//Transaction status
+#define I2C_IDLE            0
+#define I2C_BUSY            1       //Queued or on the bus
+#define I2C_DONE            2
+#define I2C_FAILED          3       //NACK, bus collision or timeout
+
+//One bus transaction. A write sends reg then len bytes from buf; a read
+//sends reg, then a repeated start and reads len bytes into buf. With
+//no_reg set the register byte and the repeated start are left out.
+//The caller owns the struct and must not touch it while it is I2C_BUSY.
+typedef struct {
+    unsigned char addr;             //7 bit address
+    unsigned char reg;
+    bool no_reg;
+    bool read;
+    unsigned char *buf;
+    unsigned char len;
+    volatile unsigned char status;
+} i2c_txn_t;
+
 void I2C_Master_Init(const unsigned long c);
-void I2C_Master_Write(unsigned d);
-unsigned char I2C_Master_Read(unsigned char a);
\ No newline at end of file
+bool I2C_Submit(i2c_txn_t *t);
+bool I2C_Transfer(i2c_txn_t *t);
+void I2C_ISR(void);
+void I2C_Tick(void);
+void delay_10ms(unsigned char n);
+
+#endif	/* I2C_H */
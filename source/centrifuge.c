@@ -0,0 +1,152 @@
+/*
+ * File:   centrifuge.c
+ */
+
+#include <xc.h>
+#include "constants.h"
+#include "centrifuge.h"
+
+//Agitation while waiting for a bottle, from the start of the wait. A bottle
+//that is still hung up after the first spells has not been shaken loose by
+//long ones, so the spells get shorter; the last two repeat until the bottle
+//comes or the run gives up on it.
+static const agitate_t agitate_calm[] = {
+    {CENTRIFUGE_OFF, 200}, {CENTRIFUGE_FORWARD, 1500}, {CENTRIFUGE_REVERSE, 800},
+    {CENTRIFUGE_FORWARD, 600}, {CENTRIFUGE_REVERSE, 600}
+};
+static const agitate_t agitate_normal[] = {
+    {CENTRIFUGE_FORWARD, 1200}, {CENTRIFUGE_REVERSE, 700}, {CENTRIFUGE_FORWARD, 500},
+    {CENTRIFUGE_REVERSE, 500}
+};
+static const agitate_t agitate_hard[] = {
+    {CENTRIFUGE_FORWARD, 800}, {CENTRIFUGE_REVERSE, 500}, {CENTRIFUGE_FORWARD, 400},
+    {CENTRIFUGE_REVERSE, 400}
+};
+
+//What the motor is asked for and what it is driven at. CentrifugeTick()
+//ramps the one towards the other, through zero when the direction changes.
+static volatile unsigned char target_dir;
+static volatile unsigned char target_duty;
+static unsigned char drive_dir;
+static unsigned char drive_duty;
+
+static const agitate_t *pattern;
+static unsigned char pattern_len;
+static unsigned char seg;
+static unsigned long seg_end;   //waited_ms at the end of seg
+static unsigned int feed_avg;
+
+//Forward is CCP1 on RC2 and reverse CCP2 on RC1 (CCP2MX = PORTC). The side
+//not in use is a plain output held low, so the bridge never sees both.
+static void CentrifugePwm(void){
+    unsigned int d = drive_duty * ((CENTRIFUGE_PR2 + 1) * 4 / 100);
+
+    if (drive_dir == CENTRIFUGE_FORWARD && d){
+        CCP2CON = 0x00;
+        CCPR1L = d >> 2;
+        CCP1CON = 0x0C | (d & 0x03) << 4;
+    }
+    else if (drive_dir == CENTRIFUGE_REVERSE && d){
+        CCP1CON = 0x00;
+        CCPR2L = d >> 2;
+        CCP2CON = 0x0C | (d & 0x03) << 4;
+    }
+    else {
+        CCP1CON = 0x00;
+        CCP2CON = 0x00;
+    }
+}
+
+void CentrifugeInit(void){
+    CCP1CON = 0x00;
+    CCP2CON = 0x00;
+    CENTRIFUGE_FWD = 0;
+    CENTRIFUGE_REV = 0;
+    target_dir = CENTRIFUGE_OFF;
+    target_duty = 0;
+    drive_dir = CENTRIFUGE_OFF;
+    drive_duty = 0;
+
+    PR2 = CENTRIFUGE_PR2;
+    T2CON = 0b00000110;     //On, prescaler 1:16 (TMR2PRESCALE)
+}
+
+//! @brief      Sets the direction and duty the motor ramps to.
+void CentrifugeDrive(unsigned char dir, unsigned char duty){
+    target_dir = dir;
+    target_duty = dir == CENTRIFUGE_OFF ? 0 : duty;
+}
+
+//! @brief      Ramps the motor down to a stop.
+void CentrifugeStop(void){
+    CentrifugeDrive(CENTRIFUGE_OFF, 0);
+}
+
+//! @brief      Moves the drive CENTRIFUGE_RAMP towards the target, called
+//!             from the ISR on every scheduler tick. A new direction only
+//!             takes over once the old one is down to zero.
+void CentrifugeTick(void){
+    unsigned char dir = target_dir;
+    unsigned char duty = target_duty;
+
+    if (dir == drive_dir && duty == drive_duty){
+        return;
+    }
+    if (dir != drive_dir){
+        drive_duty = drive_duty > CENTRIFUGE_RAMP ? drive_duty - CENTRIFUGE_RAMP : 0;
+        if (drive_duty == 0){
+            drive_dir = dir;
+        }
+    }
+    else if (duty < drive_duty){
+        drive_duty = drive_duty - duty > CENTRIFUGE_RAMP ? drive_duty - CENTRIFUGE_RAMP : duty;
+    }
+    else {
+        drive_duty = duty - drive_duty > CENTRIFUGE_RAMP ? drive_duty + CENTRIFUGE_RAMP : duty;
+    }
+    CentrifugePwm();
+}
+
+//! @brief      Forgets the feed of the last run.
+void AgitateReset(void){
+    feed_avg = (AGITATE_FAST_MS + AGITATE_SLOW_MS) / 2;
+}
+
+//! @brief      Picks the pattern for a new wait for a bottle.
+void AgitateStart(void){
+    if (feed_avg < AGITATE_FAST_MS){
+        pattern = agitate_calm;
+        pattern_len = sizeof agitate_calm / sizeof agitate_calm[0];
+    }
+    else if (feed_avg > AGITATE_SLOW_MS){
+        pattern = agitate_hard;
+        pattern_len = sizeof agitate_hard / sizeof agitate_hard[0];
+    }
+    else {
+        pattern = agitate_normal;
+        pattern_len = sizeof agitate_normal / sizeof agitate_normal[0];
+    }
+    seg = 0;
+    seg_end = pattern[0].ms;
+    CentrifugeDrive(pattern[0].dir, AGITATE_DUTY);
+}
+
+//! @brief      Follows the pattern, called while waiting for a bottle.
+//! @param      waited_ms Time since AgitateStart().
+void AgitateUpdate(unsigned long waited_ms){
+    while (waited_ms >= seg_end){
+        seg = seg + 1 < pattern_len ? seg + 1 : pattern_len - 2;
+        seg_end += pattern[seg].ms;
+    }
+    CentrifugeDrive(pattern[seg].dir, AGITATE_DUTY);
+}
+
+//! @brief      Stops the centrifuge once a bottle has come and adds the
+//!             wait to the average.
+void AgitateFed(unsigned long waited_ms){
+    CentrifugeStop();
+    if (waited_ms > 0xFFFF){
+        waited_ms = 0xFFFF;
+    }
+    feed_avg = feed_avg - (feed_avg >> AGITATE_AVG_SHIFT) + ((unsigned int)waited_ms >> AGITATE_AVG_SHIFT);
+}
@@ -0,0 +1,44 @@
+/*
+ * File:   centrifuge.h
+ */
+
+#ifndef CENTRIFUGE_H
+#define	CENTRIFUGE_H
+
+#define CENTRIFUGE_OFF      0
+#define CENTRIFUGE_FORWARD  1
+#define CENTRIFUGE_REVERSE  2
+
+//PWM from Timer2 at 1:TMR2PRESCALE: PR2 249 gives a 500 us period at
+//32 MHz, and a 10-bit duty of 10 per percent
+#define CENTRIFUGE_PR2      249
+#define CENTRIFUGE_RAMP     2       //percent of duty per ms, up or down
+
+//Duty of every agitation step. The ramps already keep reversals from
+//drawing a spike, so a lower duty only shakes the hopper less.
+#define AGITATE_DUTY        100
+
+//One step of an agitation pattern
+typedef struct {
+    unsigned char dir;      //CENTRIFUGE_*
+    unsigned int ms;
+} agitate_t;
+
+//The average wait for the last few bottles picks the pattern: under
+//AGITATE_FAST_MS bottles are dropping in on their own, over AGITATE_SLOW_MS
+//they are hanging up in the hopper. Each wait moves the average
+//1 / 2^AGITATE_AVG_SHIFT of the way.
+#define AGITATE_FAST_MS     500
+#define AGITATE_SLOW_MS     1500
+#define AGITATE_AVG_SHIFT   2
+
+void CentrifugeInit(void);
+void CentrifugeDrive(unsigned char dir, unsigned char duty);
+void CentrifugeStop(void);
+void CentrifugeTick(void);
+void AgitateReset(void);
+void AgitateStart(void);
+void AgitateUpdate(unsigned long waited_ms);
+void AgitateFed(unsigned long waited_ms);
+
+#endif	/* CENTRIFUGE_H */
@@ -0,0 +1,96 @@
+/*
+ * File:   classify.c
+ */
+
+#include <xc.h>
+#include "classify.h"
+
+static unsigned char votes[CLASS_READINGS];     //samples that read 1
+static unsigned char samples[CLASS_READINGS];
+static unsigned char bin;
+static unsigned char confidence;
+static bool resampled;
+
+//! @brief      Forgets the votes of the last bottle.
+void ClassifyStart(void){
+    for (unsigned char i = 0; i < CLASS_READINGS; i++){
+        votes[i] = 0;
+        samples[i] = 0;
+    }
+    bin = BIN_ESKA_NOCAP;
+    confidence = 0;
+    resampled = 0;
+}
+
+//! @brief      Adds one sample of a reading, see CLASS_*.
+void ClassifyVote(unsigned char reading, bool on){
+    if (samples[reading] == 0xFF){
+        return;
+    }
+    samples[reading]++;
+    if (on){
+        votes[reading]++;
+    }
+}
+
+//Votes of one reading as a quarter, 0 for none at all to 3 for three
+//quarters or more
+static unsigned char Level(unsigned char reading){
+    if (samples[reading] == 0){
+        return 0;
+    }
+    unsigned char l = (unsigned int)votes[reading] * CLASS_LEVELS / samples[reading];
+    return l < CLASS_LEVELS ? l : CLASS_LEVELS - 1;
+}
+
+//! @returns    True if at least half the type samples so far read Yop, the
+//!             same split as the Yop rows of class_table.
+bool ClassifyYop(void){
+    return Level(CLASS_TYPE) >= CLASS_LEVELS / 2;
+}
+
+//! @brief      Looks the votes up in class_table. Below
+//!             CLASSIFY_MIN_CONFIDENCE the CLASSIFY_CAP and CLASSIFY_NOCAP
+//!             fallbacks move the bottle to a fixed bin of its type; the
+//!             confidence stays what the table said.
+void ClassifyDecide(void){
+    unsigned char v = Level(CLASS_TYPE) << 4 | Level(CLASS_EDGE) << 2 | Level(CLASS_POST);
+    bin = class_table[v].bin;
+    confidence = class_table[v].confidence;
+
+    if (confidence >= CLASSIFY_MIN_CONFIDENCE){
+        return;
+    }
+#if CLASSIFY_FALLBACK == CLASSIFY_CAP
+    bin = bin <= BIN_YOP_NOCAP ? BIN_YOP_CAP : BIN_ESKA_CAP;
+#elif CLASSIFY_FALLBACK == CLASSIFY_NOCAP
+    bin = bin <= BIN_YOP_NOCAP ? BIN_YOP_NOCAP : BIN_ESKA_NOCAP;
+#endif
+}
+
+//! @brief      Asks for another round of post sensor votes, once per bottle
+//!             and only with the CLASSIFY_RESAMPLE fallback. The old post
+//!             votes are dropped.
+//! @returns    True if the caller should vote CLASS_POST again and call
+//!             ClassifyDecide() once more.
+bool ClassifyResample(void){
+#if CLASSIFY_FALLBACK == CLASSIFY_RESAMPLE
+    if (confidence < CLASSIFY_MIN_CONFIDENCE && !resampled){
+        resampled = 1;
+        votes[CLASS_POST] = 0;
+        samples[CLASS_POST] = 0;
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+//! @returns    Bin of the last ClassifyDecide(), see BIN_*.
+unsigned char ClassifyBin(void){
+    return bin;
+}
+
+//! @returns    Confidence of the last ClassifyDecide() in percent.
+unsigned char ClassifyConfidence(void){
+    return confidence;
+}
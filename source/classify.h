@@ -0,0 +1,63 @@
+/*
+ * File:   classify.h
+ */
+
+#ifndef CLASSIFY_H
+#define	CLASSIFY_H
+
+#include <stdbool.h>
+
+//Readings that make up a bottle's sensor vector. The edge and post votes
+//come from the sensors of the type the type votes settle on.
+#define CLASS_TYPE          0   //type sensor, votes for Yop
+#define CLASS_EDGE          1   //edge sensor, votes for a cap
+#define CLASS_POST          2   //post sensor, votes for a cap
+#define CLASS_READINGS      3
+
+//Samples per reading, taken at the end of its dwell time. The sensors are
+//noisy over about 10 ms, so samples further apart than that vote apart.
+#define CLASS_SAMPLES       16
+#define CLASS_PERIOD_MS     20
+#define CLASS_SAMPLE_MS     (CLASS_SAMPLES * CLASS_PERIOD_MS)
+
+//Each reading's votes are cut into quarters, 2 bits a reading. The vector
+//type << 4 | edge << 2 | post picks the bin from class_table.
+#define CLASS_LEVELS        4
+#define CLASS_VECTORS       64
+
+//Bins, the same as BinServoSetTarget()
+#define BIN_YOP_CAP         1
+#define BIN_YOP_NOCAP       2
+#define BIN_ESKA_CAP        3
+#define BIN_ESKA_NOCAP      4
+
+//Bin and confidence, in percent, for one sensor vector
+typedef struct {
+    unsigned char bin;
+    unsigned char confidence;
+} class_entry_t;
+
+extern const class_entry_t class_table[CLASS_VECTORS];
+
+//What happens to a bottle classified below CLASSIFY_MIN_CONFIDENCE
+#define CLASSIFY_KEEP       0   //the table's bin stands
+#define CLASSIFY_RESAMPLE   1   //vote the post sensor again, then keep
+#define CLASSIFY_CAP        2   //the cap bin of the table's type
+#define CLASSIFY_NOCAP      3   //the no cap bin of the table's type
+
+#ifndef CLASSIFY_FALLBACK
+#define CLASSIFY_FALLBACK   CLASSIFY_RESAMPLE
+#endif
+#ifndef CLASSIFY_MIN_CONFIDENCE
+#define CLASSIFY_MIN_CONFIDENCE 70
+#endif
+
+void ClassifyStart(void);
+void ClassifyVote(unsigned char reading, bool on);
+bool ClassifyYop(void);
+void ClassifyDecide(void);
+bool ClassifyResample(void);
+unsigned char ClassifyBin(void);
+unsigned char ClassifyConfidence(void);
+
+#endif	/* CLASSIFY_H */
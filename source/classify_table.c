@@ -0,0 +1,50 @@
+/*
+ * File:   classify_table.c
+ */
+
+#include <xc.h>
+#include "classify.h"
+
+//Bin and confidence for every sensor vector, see classify.h. Swap this file
+//to retune the classifier without touching the firmware around it.
+//
+//Worked out for 16 samples a reading from the hit rates of the sensors:
+//type 98% for Yop and 2% for Eska, edge and post 95% with a Yop cap, 10%
+//without, 75% with an Eska cap and 5% without. The edge and post votes
+//come from the sensors of the majority type, which never see a bottle of
+//the other type. Each reading also has a 10% chance of coming from a
+//faulty sensor and saying anything, so readings that contradict each other
+//come out near 50% rather than trusting the least unlikely. The bin is the
+//likeliest one of the type the sensors were picked for, with all four
+//equally common, and the confidence how likely it is out of all four. Where
+//one sensor is full and the other empty the bin follows the rules the
+//sorter always had, a cap if either Eska sensor sees one and only if both
+//Yop sensors do, and the low confidence asks for a resample.
+#define YC  BIN_YOP_CAP
+#define YN  BIN_YOP_NOCAP
+#define EC  BIN_ESKA_CAP
+#define EN  BIN_ESKA_NOCAP
+
+const class_entry_t class_table[CLASS_VECTORS] = {
+    //post:   0-3         4-7         8-11        12-16 of 16
+    //type Eska
+    {EN, 95},  {EN, 94},  {EN, 70},  {EC, 33},   //edge 0-3
+    {EN, 94},  {EC, 50},  {EC, 94},  {EC, 95},   //edge 4-7
+    {EN, 70},  {EC, 94},  {EC, 99},  {EC, 99},   //edge 8-11
+    {EC, 33},  {EC, 95},  {EC, 99},  {EC, 99},   //edge 12-16
+    //type Eska, unsure
+    {EN, 33},  {EN, 38},  {EN, 30},  {EC, 15},   //edge 0-3
+    {EN, 38},  {EC, 32},  {EC, 85},  {EC, 89},   //edge 4-7
+    {EN, 30},  {EC, 85},  {EC, 99},  {EC, 99},   //edge 8-11
+    {EC, 15},  {EC, 89},  {EC, 99},  {EC, 99},   //edge 12-16
+    //type Yop, unsure
+    {YN, 30},  {YN, 62},  {YN, 32},  {YN, 25},   //edge 0-3
+    {YN, 62},  {YN, 81},  {YN, 54},  {YC, 85},   //edge 4-7
+    {YN, 32},  {YN, 54},  {YC, 26},  {YC, 92},   //edge 8-11
+    {YN, 25},  {YC, 85},  {YC, 92},  {YC, 99},   //edge 12-16
+    //type Yop
+    {YN, 93},  {YN, 97},  {YN, 91},  {YN, 52},   //edge 0-3
+    {YN, 97},  {YN, 92},  {YN, 77},  {YC, 90},   //edge 4-7
+    {YN, 91},  {YN, 77},  {YC, 50},  {YC, 97},   //edge 8-11
+    {YN, 52},  {YC, 90},  {YC, 97},  {YC, 99},   //edge 12-16
+};
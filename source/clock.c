@@ -0,0 +1,141 @@
+/*
+ * File:   clock.c
+ */
+
+#include <xc.h>
+#include "configBits.h"
+#include "constants.h"
+#include "I2C.h"
+#include "clock.h"
+
+//The DS1307 is read once at start-up; after that its 1 Hz square wave on
+//RB2/INT2 ticks a copy of the time registers kept here, so reading the
+//time never goes near the bus.
+
+#define DS1307_CONTROL      0x07
+#define DS1307_SQW_1HZ      0x10    //SQWE set, RS1:RS0 = 00
+
+static volatile unsigned char clock_regs[7];
+static volatile unsigned long clock_secs;
+
+//Last day of each month, BCD
+static const unsigned char month_last[12] = {
+    0x31, 0x28, 0x31, 0x30, 0x31, 0x30, 0x31, 0x31, 0x30, 0x31, 0x30, 0x31
+};
+
+static bool RtcTransfer(unsigned char reg, unsigned char *buf, unsigned char len, bool read){
+    i2c_txn_t t;
+    t.addr = RTC_ADDR;
+    t.reg = reg;
+    t.no_reg = 0;
+    t.read = read;
+    t.buf = buf;
+    t.len = len;
+    return I2C_Transfer(&t);
+}
+
+void ClockInit(void){
+    unsigned char control = DS1307_SQW_1HZ;
+
+    clock_secs = 0;
+    INTEDG2 = 1;    //The seconds register ticks over on the rising edge
+    RtcTransfer(DS1307_CONTROL, &control, 1, 0);
+    ClockSync();
+}
+
+//! @brief      Reloads the time from the DS1307.
+void ClockSync(void){
+    unsigned char regs[7];
+
+    INT2IE = 0;
+    do {
+        //Read again if a second ticked over halfway through
+        INT2IF = 0;
+        if (!RtcTransfer(0x00, regs, 7, 1)){
+            break;
+        }
+        for (unsigned char i = 0; i < 7; i++){
+            clock_regs[i] = regs[i];
+        }
+    } while (INT2IF);
+    INT2IE = 1;
+}
+
+//! @brief      Sets the DS1307 and the local copy.
+//! @param      regs    seven time registers in DS1307 order
+//! @returns    false if the RTC did not take the write.
+bool ClockSet(const unsigned char *regs){
+    unsigned char buf[7];
+    bool ok;
+
+    for (unsigned char i = 0; i < 7; i++){
+        buf[i] = regs[i];
+    }
+    INT2IE = 0;
+    ok = RtcTransfer(0x00, buf, 7, 0);
+    if (ok){
+        //Writing the seconds restarts the DS1307's one second countdown
+        for (unsigned char i = 0; i < 7; i++){
+            clock_regs[i] = buf[i];
+        }
+        INT2IF = 0;
+    }
+    INT2IE = 1;
+    return ok;
+}
+
+//! @brief      Copies out the current time.
+//! @param      regs    seven bytes, filled in DS1307 order
+void ClockNow(unsigned char *regs){
+    bool ie = INT2IE;
+    INT2IE = 0;
+    for (unsigned char i = 0; i < 7; i++){
+        regs[i] = clock_regs[i];
+    }
+    INT2IE = ie;
+}
+
+//! @brief      Reads the seconds counter.
+//! @returns    Seconds since ClockInit(), unaffected by setting the time.
+unsigned long ClockSeconds(void){
+    unsigned long s;
+    bool ie = INT2IE;
+    INT2IE = 0;
+    s = clock_secs;
+    INT2IE = ie;
+    return s;
+}
+
+//Adds one to a BCD register, wrapping from last back to first
+static bool BcdNext(volatile unsigned char *v, unsigned char last, unsigned char first){
+    if (*v >= last){
+        *v = first;
+        return true;
+    }
+    *v += ((*v & 0x0F) == 9) ? 7 : 1;
+    return false;
+}
+
+//! @brief      Counts one second, called from the ISR on INT2IF.
+void ClockTick(void){
+    unsigned char month, year, last_day;
+
+    clock_secs++;
+    if (!BcdNext(&clock_regs[CLOCK_SEC], 0x59, 0x00) ||
+        !BcdNext(&clock_regs[CLOCK_MIN], 0x59, 0x00) ||
+        !BcdNext(&clock_regs[CLOCK_HOUR], 0x23, 0x00)){
+        return;
+    }
+    BcdNext(&clock_regs[CLOCK_WEEKDAY], 0x07, 0x01);
+
+    month = (clock_regs[CLOCK_MONTH] >> 4) * 10 + (clock_regs[CLOCK_MONTH] & 0x0F);
+    year = (clock_regs[CLOCK_YEAR] >> 4) * 10 + (clock_regs[CLOCK_YEAR] & 0x0F);
+    last_day = (month >= 1 && month <= 12) ? month_last[month - 1] : 0x31;
+    if (month == 2 && year % 4 == 0){
+        last_day = 0x29;
+    }
+    if (BcdNext(&clock_regs[CLOCK_DAY], last_day, 0x01) &&
+        BcdNext(&clock_regs[CLOCK_MONTH], 0x12, 0x01)){
+        BcdNext(&clock_regs[CLOCK_YEAR], 0x99, 0x00);
+    }
+}
@@ -0,0 +1,26 @@
+/*
+ * File:   clock.h
+ */
+
+#ifndef CLOCK_H
+#define	CLOCK_H
+
+#include <stdbool.h>
+
+//Time registers in DS1307 order, all BCD
+#define CLOCK_SEC           0
+#define CLOCK_MIN           1
+#define CLOCK_HOUR          2
+#define CLOCK_WEEKDAY       3
+#define CLOCK_DAY           4
+#define CLOCK_MONTH         5
+#define CLOCK_YEAR          6
+
+void ClockInit(void);
+void ClockSync(void);
+bool ClockSet(const unsigned char *regs);
+void ClockNow(unsigned char *regs);
+unsigned long ClockSeconds(void);
+void ClockTick(void);
+
+#endif	/* CLOCK_H */
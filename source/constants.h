@@ -9,8 +9,67 @@
 #define RS          LATDbits.LATD2          
 #define E           LATDbits.LATD3
 #define	LCD_PORT    LATD   //On LATD[4,7] to be specific
-#define LCD_DELAY   25
+#define LCD_RW      LATEbits.LATE2
 
+//LCD_READBACK 1 reads the busy flag, which needs R/W wired to RE2. With 0
+//R/W may be tied low and the driver waits the datasheet times instead.
+#ifndef LCD_READBACK
+#define LCD_READBACK 0
+#endif
 
-#endif	/* CONSTANTS_H */
+//Stepper motor (carriage), half-step phases on RA0-RA3
+#define STEPPER_PORT        LATA
+#define STEPPER_MASK        0x0F    //The rest of the port is left alone
+
+//Bin selector servo
+#define BIN_SERVO           LATCbits.LC0
+
+//Centrifuge H-bridge
+#define CENTRIFUGE_FWD      LATCbits.LC2
+#define CENTRIFUGE_REV      LATCbits.LC1
+
+//UART_LINK 1 gives RC6/RC7 to the EUSART for the PC command link (link.h)
+//and moves the post and top sensor supplies to RB3 and RA7
+#ifndef UART_LINK
+#define UART_LINK           0
+#endif
+
+//Sensor supply switches
+#define EDGE_SENSOR_PWR     LATCbits.LC5
+#if UART_LINK
+#define POST_SENSOR_PWR     LATBbits.LB3
+#define TOP_SENSOR_PWR      LATAbits.LA7
+#else
+#define POST_SENSOR_PWR     LATCbits.LC6
+#define TOP_SENSOR_PWR      LATCbits.LC7
+#endif
+
+//Sensor inputs
+#define EXIST_SENSOR        PORTEbits.RE0
+#define TYPE_SENSOR         PORTEbits.RE1   //1 is Yop, 0 is Eska
+#define YOP_EDGE_SENSOR     PORTAbits.RA4
+#define ESKA_EDGE_SENSOR    PORTAbits.RA5
+#define YOP_POST_SENSOR     PORTDbits.RD0
+#define ESKA_POST_SENSOR    PORTDbits.RD1
+#define HOME_SWITCH         PORTBbits.RB0   //Low when carriage is at the top
+#define RTC_SQW             PORTBbits.RB2   //DS1307 1 Hz square wave, INT2
 
+//I2C slaves
+#define RTC_ADDR            0x68    //DS1307
+#define PC_ADDR             0x08    //PC interface, takes the log transfer
+
+//Keypad encoder data on RB4-RB7, data available on RB1/INT1
+#define KEYPAD_DATA         ((PORTB & 0xF0) >> 4)
+
+//Pipelined run: the servo heads for the Yop or Eska bins as soon as the
+//type is known, and the next bottle is fed while the carriage returns
+#ifndef PIPELINE_RUN
+#define PIPELINE_RUN        1
+#endif
+
+//Main loop idle hook, the host simulator uses it to advance its clock
+#ifndef __loop_idle
+#define __loop_idle()
+#endif
+
+#endif	/* CONSTANTS_H */
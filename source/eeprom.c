@@ -1,17 +1,22 @@
 #include <xc.h>
 #include "configBits.h"
-#include <stdio.h>
-#include "lcd.h"
 #include "constants.h"
+#include "eeprom.h"
 
-//! @brief      Reads a single byte of data from the EEPROM.
-//! @param      address     The EEPROM address to write the data to (note that not all
-//!                         16-bits of this variable may be supported).
-//! @returns    The byte of data read from EEPROM.
-//! @warning    This function does not return until read operation is complete.
-int Eeprom_ReadByte(int address)
-{
+//Write-behind queue. Bytes wait here until the EEPROM is free; the write
+//complete interrupt (EEIF) then starts the next one, so callers never sit
+//through the ~4 ms write cycle. The entry being written stays queued until
+//it completes, which lets reads see every byte that is still on its way.
+static struct {
+    unsigned int address;
+    unsigned char data;
+} queue[EEPROM_QUEUE_LEN];
+static volatile unsigned char head, tail;
+static volatile bool writing;
 
+//Raw read, only valid while no write is in progress
+static unsigned char ReadRaw(unsigned int address)
+{
     // Set address registers
     EEADRH = (address >> 8);
     EEADR = address;
@@ -25,39 +30,115 @@ int Eeprom_ReadByte(int address)
     while(EECON1bits.RD == 1);
 
     return EEDATA;              // Return data
+}
+
+//Starts writing the oldest queued byte that differs from what is stored.
+//Called from Eeprom_QueueByte() with EEIE clear, or from Eeprom_ISR().
+static void StartNext(void)
+{
+    while (head != tail){
+        unsigned int address = queue[tail].address;
+        unsigned char data = queue[tail].data;
+        if (ReadRaw(address) == data){
+            tail = (tail + 1) % EEPROM_QUEUE_LEN;   //Unchanged, skip it
+            continue;
+        }
 
+        // Set address registers
+        EEADRH = (address >> 8);
+        EEADR = address;
+
+        EEDATA = data;          // Write data we want to write to SFR
+        EECON1bits.EEPGD = 0;   // Select EEPROM data memory
+        EECON1bits.CFGS = 0;    // Access flash/EEPROM NOT config. registers
+        EECON1bits.WREN = 1;    // Enable writing of EEPROM (this is disabled again after the write completes)
+
+        // The next three lines of code perform the required operations to
+        // initiate a EEPROM write, with no interrupt in between
+        bool gie = GIE;
+        di();
+        EECON2 = 0x55;          // Part of required sequence for write to internal EEPROM
+        EECON2 = 0xAA;          // Part of required sequence for write to internal EEPROM
+        EECON1bits.WR = 1;      // Part of required sequence for write to internal EEPROM
+        if (gie){
+            ei();
+        }
+        writing = 1;
+        return;
+    }
+    writing = 0;
+    EECON1bits.WREN = 0;    // Disable write (for safety, it is re-enabled next time a EEPROM write is performed)
 }
 
-//! @brief      Writes a single byte of data to the EEPROM.
+void Eeprom_Init(void)
+{
+    head = 0;
+    tail = 0;
+    writing = 0;
+    PIR2bits.EEIF = 0;
+    PIE2bits.EEIE = 1;
+    PEIE = 1;
+}
+
+//! @brief      Reads a single byte of data from the EEPROM.
 //! @param      address     The EEPROM address to write the data to (note that not all
 //!                         16-bits of this variable may be supported).
-//! @param      data        The data to write to EEPROM.
-//! @warning    This function does not return until write operation is complete.
-void Eeprom_WriteByte(int address,int data)
-{    
-    // Set address registers
-    EEADRH = (address >> 8);
-    EEADR = address;
+//! @returns    The byte of data read from EEPROM, or the newest queued
+//!             value for that address if it has not been written yet.
+//! @warning    Waits for a write in progress, at most one write cycle.
+int Eeprom_ReadByte(int address)
+{
+    unsigned char data;
+    bool ie = PIE2bits.EEIE;
+    PIE2bits.EEIE = 0;
+    for (unsigned char i = head; i != tail; ){
+        i = (i + EEPROM_QUEUE_LEN - 1) % EEPROM_QUEUE_LEN;
+        if (queue[i].address == address){
+            data = queue[i].data;
+            PIE2bits.EEIE = ie;
+            return data;
+        }
+    }
+    while (EECON1bits.WR){
+        continue;   // Do nothing, the queued write finishes first
+    }
+    data = ReadRaw(address);
+    PIE2bits.EEIE = ie;
+    return data;
+}
+
+//! @brief      Queues a single byte for writing to the EEPROM.
+//! @warning    Only waits if the queue is full.
+void Eeprom_QueueByte(int address, unsigned char data)
+{
+    while ((head + 1) % EEPROM_QUEUE_LEN == tail){
+        __delay_us(10);     //The ISR frees a slot every write cycle
+    }
+    bool ie = PIE2bits.EEIE;
+    PIE2bits.EEIE = 0;
+    queue[head].address = address;
+    queue[head].data = data;
+    head = (head + 1) % EEPROM_QUEUE_LEN;
+    if (!writing){
+        StartNext();
+    }
+    PIE2bits.EEIE = ie;
+}
 
-    EEDATA = data;          // Write data we want to write to SFR
-    EECON1bits.EEPGD = 0;   // Select EEPROM data memory
-    EECON1bits.CFGS = 0;    // Access flash/EEPROM NOT config. registers
-    EECON1bits.WREN = 1;    // Enable writing of EEPROM (this is disabled again after the write completes)
-
-    // The next three lines of code perform the required operations to
-    // initiate a EEPROM write
-    EECON2 = 0x55;          // Part of required sequence for write to internal EEPROM
-    EECON2 = 0xAA;          // Part of required sequence for write to internal EEPROM
-    EECON1bits.WR = 1;      // Part of required sequence for write to internal EEPROM
-
-    // Loop until write operation is complete
-    while(PIR2bits.EEIF == 0)
-    {
-        continue;   // Do nothing, are just waiting
+//! @brief      Queues len bytes to be written from address on.
+void Eeprom_QueueRecord(int address, const unsigned char *data, unsigned char len)
+{
+    for (unsigned char i = 0; i < len; i++){
+        Eeprom_QueueByte(address + i, data[i]);
     }
+}
 
+//! @brief      Called from the ISR on EEIF, when a write has completed.
+void Eeprom_ISR(void)
+{
     PIR2bits.EEIF = 0;      //Clearing EEIF bit (this MUST be cleared in software after each write)
-    EECON1bits.WREN = 0;    // Disable write (for safety, it is re-enabled next time a EEPROM write is performed)
+    if (writing){
+        tail = (tail + 1) % EEPROM_QUEUE_LEN;
+    }
+    StartNext();
 }
-
- 
@@ -1,3 +1,9 @@
-int Eeprom_ReadByte(int address);
-void Eeprom_WriteByte(int address,int data);
+#include <stdbool.h>
+
+#define EEPROM_QUEUE_LEN    48      //A run, its profile and the clear mark
 
+void Eeprom_Init(void);
+int Eeprom_ReadByte(int address);
+void Eeprom_QueueByte(int address, unsigned char data);
+void Eeprom_QueueRecord(int address, const unsigned char *data, unsigned char len);
+void Eeprom_ISR(void);
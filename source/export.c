@@ -0,0 +1,160 @@
+/*
+ * File:   export.c
+ */
+
+#include <xc.h>
+#include "constants.h"
+#include "I2C.h"
+#include "scheduler.h"
+#include "clock.h"
+#include "journal.h"
+#include "export.h"
+
+#define POLL_MS             2       //Between status reads while the PC is busy
+#define REPLY_TIMEOUT_MS    200
+#define MAX_TRIES           5       //Attempts at a frame before giving up
+
+#define FRAME_MAX           (5 + 1 + EXPORT_RUNS_FRAME * EXPORT_RECORD)
+
+static task_t export_task;
+static unsigned char state;
+static unsigned char runs;          //Runs stored when the export started
+static unsigned char newest;        //and the newest one's sequence number
+static unsigned char frame, frames, tries;
+static unsigned char frame_buf[FRAME_MAX];
+static unsigned char reply[2];
+static unsigned int reply_start;
+static i2c_txn_t txn;
+
+static unsigned char Bcd(unsigned char v){
+    return (v >> 4) * 10 + (v & 0x0F);
+}
+
+//! @brief      Fills in the 40 bytes the PC takes for a run: date and time,
+//!             whole seconds, the four counts, the bottle total, the run
+//!             time in ms, low byte first, and the phase profile (minimum,
+//!             mean and maximum of each phase, see profile.h). A missing
+//!             run is all zero.
+void ExportRecord(unsigned char run, unsigned char *buf){
+    run_t r;
+    unsigned long ms;
+
+    if (!JournalRead(run, &r)){
+        for (unsigned char i = 0; i < EXPORT_RECORD; i++){
+            buf[i] = 0;
+        }
+        return;
+    }
+    buf[0] = Bcd(r.time[CLOCK_YEAR]);
+    buf[1] = Bcd(r.time[CLOCK_MONTH]);
+    buf[2] = Bcd(r.time[CLOCK_DAY]);
+    buf[3] = Bcd(r.time[CLOCK_HOUR]);
+    buf[4] = Bcd(r.time[CLOCK_MIN]);
+    buf[5] = Bcd(r.time[CLOCK_SEC]);
+    buf[6] = r.run_ms < 255000 ? r.run_ms / 1000 : 255;
+    buf[7] = r.cap_yop;
+    buf[8] = r.nocap_yop;
+    buf[9] = r.cap_eska;
+    buf[10] = r.nocap_eska;
+    buf[11] = RUN_BOTTLES(&r);
+    ms = r.run_ms;
+    for (unsigned char i = 12; i < 16; i++){
+        buf[i] = ms;
+        ms >>= 8;
+    }
+    JournalProfile(run, (profile_t *)(buf + 16));
+}
+
+//Builds frame seq into frame_buf and returns its length
+static unsigned char BuildFrame(unsigned char seq){
+    unsigned char *p = frame_buf + 4;
+    unsigned char len;
+
+    frame_buf[0] = EXPORT_SOF;
+    frame_buf[2] = seq;
+    if (seq == 0){
+        frame_buf[1] = EXPORT_HEADER;
+        p[0] = EXPORT_VERSION;
+        p[1] = runs;
+        p[2] = EXPORT_RECORD;
+        p[3] = EXPORT_RUNS_FRAME;
+        p[4] = newest;
+        len = 5;
+    } else if (seq == frames - 1){
+        frame_buf[1] = EXPORT_END;
+        p[0] = runs;
+        len = 1;
+    } else {
+        unsigned char run = (seq - 1) * EXPORT_RUNS_FRAME + 1;
+        frame_buf[1] = EXPORT_RUNS;
+        p[0] = run;
+        len = 1;
+        for (unsigned char i = 0; i < EXPORT_RUNS_FRAME && run <= runs; i++, run++){
+            ExportRecord(run, p + len);
+            len += EXPORT_RECORD;
+        }
+    }
+    frame_buf[3] = len;
+    p[len] = Crc8(frame_buf + 1, len + 3);
+    return len + 5;
+}
+
+//! @brief      Starts sending the stored runs; ExportTask does the work.
+void ExportStart(void){
+    runs = JournalCount();
+    newest = JournalNewest();
+    frames = 2 + (runs + EXPORT_RUNS_FRAME - 1) / EXPORT_RUNS_FRAME;
+    state = EXPORT_RUNNING;
+}
+
+unsigned char ExportState(void){
+    return state;
+}
+
+void ExportTask(void){
+    TASK_BEGIN(&export_task);
+    while(1){
+        TASK_WAIT_UNTIL(&export_task, state == EXPORT_RUNNING);
+        frame = 0;
+        tries = 0;
+        while (frame < frames){
+            txn.addr = PC_ADDR;
+            txn.no_reg = 1;
+            txn.read = 0;
+            txn.buf = frame_buf;
+            txn.len = BuildFrame(frame);
+            TASK_WAIT_UNTIL(&export_task, I2C_Submit(&txn));
+            TASK_WAIT_UNTIL(&export_task, txn.status != I2C_BUSY);
+
+            //Ask for the verdict until the PC has checked the frame
+            reply[0] = EXPORT_PC_BUSY;
+            reply_start = SchedTicks();
+            while (txn.status == I2C_DONE && reply[0] == EXPORT_PC_BUSY &&
+                   SchedTicks() - reply_start < REPLY_TIMEOUT_MS){
+                TASK_WAIT_MS(&export_task, POLL_MS);
+                txn.read = 1;
+                txn.buf = reply;
+                txn.len = 2;
+                TASK_WAIT_UNTIL(&export_task, I2C_Submit(&txn));
+                TASK_WAIT_UNTIL(&export_task, txn.status != I2C_BUSY);
+            }
+
+            if (txn.status == I2C_DONE && reply[0] == EXPORT_PC_READY &&
+                reply[1] <= frames && reply[1] > frame){
+                frame = reply[1];
+                tries = 0;
+            } else if (txn.status == I2C_DONE && reply[0] == EXPORT_PC_READY &&
+                       reply[1] < frames){
+                frame = reply[1];       //Sent again from where the PC is
+                tries++;
+            } else {
+                tries++;
+            }
+            if (tries >= MAX_TRIES){
+                break;
+            }
+        }
+        state = (frame >= frames) ? EXPORT_DONE : EXPORT_FAILED;
+    }
+    TASK_END(&export_task);
+}
@@ -0,0 +1,44 @@
+/*
+ * File:   export.h
+ */
+
+#ifndef EXPORT_H
+#define	EXPORT_H
+
+//Framed log export to the PC interface on the I2C bus. Every transaction
+//carries one frame:
+//
+//  0xA5, type, seq, len, payload[len], CRC-8 of type..payload
+//
+//Frame 0 is the header (format version, number of runs, bytes per run,
+//runs per frame, sequence number of the newest run), frames 1..n carry
+//the runs oldest first (number of the first run, then a 40-byte record
+//each) and the last frame is the end marker (number of runs). After each
+//frame the firmware reads two bytes back: a status, and the frame the PC
+//wants next. A bad CRC asks for the same frame again; a PC that already
+//holds part of the same log, the whole header alike, answers the header
+//with the frame to resume from.
+#define EXPORT_VERSION      3       //2 added the phase profile, 3 the newest run
+#define EXPORT_SOF          0xA5
+#define EXPORT_HEADER       'H'
+#define EXPORT_RUNS         'R'
+#define EXPORT_END          'E'
+#define EXPORT_RECORD       40
+#define EXPORT_RUNS_FRAME   2
+
+//Status byte of the PC's reply
+#define EXPORT_PC_BUSY      0x00    //Still taking the last frame, ask again
+#define EXPORT_PC_READY     0x01
+
+//Export state
+#define EXPORT_IDLE         0
+#define EXPORT_RUNNING      1
+#define EXPORT_DONE         2
+#define EXPORT_FAILED       3       //The PC stopped answering or kept rejecting a frame
+
+void ExportStart(void);
+unsigned char ExportState(void);
+void ExportRecord(unsigned char run, unsigned char *buf);
+void ExportTask(void);
+
+#endif	/* EXPORT_H */
@@ -0,0 +1,78 @@
+/*
+ * File:   format.c
+ */
+
+#include <xc.h>
+#include "lcd.h"
+#include "clock.h"
+#include "format.h"
+
+//Fixed formats for the screens, written at the display's write position.
+//printf() is not used, its formatter is large and slow on the PIC18.
+
+static char HexDigit(unsigned char n){
+    return n < 10 ? '0' + n : 'a' + n - 10;
+}
+
+void FmtStr(const char *s){
+    while (*s){
+        putch(*s++);
+    }
+}
+
+//! @brief      Writes s and pads it with spaces to width characters.
+void FmtPadded(const char *s, unsigned char width){
+    while (*s){
+        putch(*s++);
+        if (width){
+            width--;
+        }
+    }
+    while (width--){
+        putch(' ');
+    }
+}
+
+//! @brief      Writes v in decimal, with leading zeros up to width digits.
+void FmtDec(unsigned long v, unsigned char width){
+    char digits[10];
+    unsigned char n = 0;
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (width > n){
+        putch('0');
+        width--;
+    }
+    while (n){
+        putch(digits[--n]);
+    }
+}
+
+//! @brief      Writes both digits of a BCD byte.
+void FmtBcd(unsigned char v){
+    putch(HexDigit(v >> 4));
+    putch(HexDigit(v & 0x0F));
+}
+
+//! @brief      Writes DS1307 time registers as YY-M-DD HH:MM:SS, or as
+//!             YYMM-DD HH:MM:SS for October to December, which keeps the
+//!             date to 16 characters.
+void FmtDate(const unsigned char *t){
+    FmtBcd(t[CLOCK_YEAR]);
+    if (t[CLOCK_MONTH] > 9){
+        FmtBcd(t[CLOCK_MONTH]);
+    } else {
+        putch('-');
+        putch(HexDigit(t[CLOCK_MONTH]));
+    }
+    putch('-');
+    FmtBcd(t[CLOCK_DAY]);
+    putch(' ');
+    FmtBcd(t[CLOCK_HOUR]);
+    putch(':');
+    FmtBcd(t[CLOCK_MIN]);
+    putch(':');
+    FmtBcd(t[CLOCK_SEC]);
+}
@@ -0,0 +1,14 @@
+/*
+ * File:   format.h
+ */
+
+#ifndef FORMAT_H
+#define	FORMAT_H
+
+void FmtStr(const char *s);
+void FmtPadded(const char *s, unsigned char width);
+void FmtDec(unsigned long v, unsigned char width);
+void FmtBcd(unsigned char v);
+void FmtDate(const unsigned char *t);
+
+#endif	/* FORMAT_H */
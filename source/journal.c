@@ -0,0 +1,388 @@
+/*
+ * File:   journal.c
+ */
+
+#include <xc.h>
+#include "eeprom.h"
+#include "clock.h"
+#include "journal.h"
+
+//Record layout: byte 0 is the sequence number, bytes 1-8 the packed fields
+//below (bit offset into those bytes, width) and byte 9 a CRC-8 of bytes 0-8.
+//Slots are written in order from 0 with consecutive sequence numbers, so
+//every slot is worn equally and no byte is rewritten on each run.
+#define PAYLOAD         8
+#define F_YEAR          0, 7
+#define F_MONTH         7, 4
+#define F_DAY           11, 5
+#define F_HOUR          16, 5
+#define F_MIN           21, 6
+#define F_SEC           27, 6
+#define F_RUN_TIME      33, 15      //10 ms units
+#define F_CAP_YOP       48, 4
+#define F_NOCAP_YOP     52, 4
+#define F_CAP_ESKA      56, 4
+#define F_NOCAP_ESKA    60, 4
+
+//A profile record is the sequence number of its run, profile_t as it is in
+//RAM and a CRC-8. Each run's profile goes over the oldest one, so only the
+//newest JOURNAL_PROFILES runs have one.
+#define PROFILE_AT      (JOURNAL_SLOTS * JOURNAL_RECORD)
+
+//Clearing the log stores the sequence number of the newest run it hides,
+//and its complement, here. It is only written by a clear and once more
+//when a full ring of newer runs makes it stale.
+#define CLEAR_MARK      (PROFILE_AT + JOURNAL_PROFILES * JOURNAL_PROFILE)
+
+static unsigned char head;          //Next slot to write
+static unsigned char count;         //Visible runs, ending at the slot before head
+static unsigned char next_seq;
+static bool clear_marked;
+static unsigned char prof_seq[JOURNAL_PROFILES];    //Run of each profile slot
+static bool prof_valid[JOURNAL_PROFILES];
+
+//RAM copy of every slot's packed fields, so the log screens and the totals
+//never read the EEPROM after start-up
+static unsigned char run_index[JOURNAL_SLOTS][PAYLOAD];
+static journal_stats_t stats;
+
+//! @brief      CRC-8, polynomial x^8 + x^2 + x + 1, preset to 0xFF.
+unsigned char Crc8(const unsigned char *p, unsigned char len){
+    unsigned char crc = 0xFF;       //Erased and zeroed slots never check out
+    while (len--){
+        crc ^= *p++;
+        for (unsigned char i = 0; i < 8; i++){
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static void PutBits(unsigned char *rec, unsigned char pos, unsigned char width, unsigned int v){
+    for (unsigned char i = 0; i < width; i++, pos++){
+        if (v & 1){
+            rec[pos >> 3] |= 1 << (pos & 7);
+        }
+        v >>= 1;
+    }
+}
+
+static unsigned int GetBits(const unsigned char *rec, unsigned char pos, unsigned char width){
+    unsigned int v = 0;
+    pos += width;
+    while (width--){
+        pos--;
+        v = (v << 1) | ((rec[pos >> 3] >> (pos & 7)) & 1);
+    }
+    return v;
+}
+
+static unsigned char BcdToBin(unsigned char v){
+    return (v >> 4) * 10 + (v & 0x0F);
+}
+
+static unsigned char BinToBcd(unsigned char v){
+    return ((v / 10) << 4) | (v % 10);
+}
+
+//Reads a slot, false if its CRC does not match
+static bool ReadSlot(unsigned char slot, unsigned char *rec){
+    unsigned int addr = slot * JOURNAL_RECORD;
+    for (unsigned char i = 0; i < JOURNAL_RECORD; i++){
+        rec[i] = Eeprom_ReadByte(addr + i);
+    }
+    return Crc8(rec, JOURNAL_RECORD - 1) == rec[JOURNAL_RECORD - 1];
+}
+
+static bool ReadProfileSlot(unsigned char slot, unsigned char *rec){
+    unsigned int addr = PROFILE_AT + slot * JOURNAL_PROFILE;
+    for (unsigned char i = 0; i < JOURNAL_PROFILE; i++){
+        rec[i] = Eeprom_ReadByte(addr + i);
+    }
+    return Crc8(rec, JOURNAL_PROFILE - 1) == rec[JOURNAL_PROFILE - 1];
+}
+
+static bool SlotValid(unsigned char slot){
+    unsigned char rec[JOURNAL_RECORD];
+    return ReadSlot(slot, rec);
+}
+
+//Slot holding a run, 1 for the oldest up to count for the newest
+static unsigned char RunSlot(unsigned char run){
+    return (head + JOURNAL_SLOTS - count + run - 1) % JOURNAL_SLOTS;
+}
+
+//Sequence number of a run, 1 for the oldest up to count for the newest
+static unsigned char RunSeq(unsigned char run){
+    return next_seq - 1 - (count - run);
+}
+
+//Profile slot holding a run's profile, JOURNAL_PROFILES if none does
+static unsigned char ProfileSlot(unsigned char seq){
+    for (unsigned char i = 0; i < JOURNAL_PROFILES; i++){
+        if (prof_valid[i] && prof_seq[i] == seq){
+            return i;
+        }
+    }
+    return JOURNAL_PROFILES;
+}
+
+//Profile slot to write next: an empty one, else the oldest run's
+static unsigned char OldestProfile(void){
+    unsigned char oldest = 0;
+    for (unsigned char i = 0; i < JOURNAL_PROFILES; i++){
+        if (!prof_valid[i]){
+            return i;
+        }
+        if ((unsigned char)(next_seq - prof_seq[i]) > (unsigned char)(next_seq - prof_seq[oldest])){
+            oldest = i;
+        }
+    }
+    return oldest;
+}
+
+//Bottles per minute in tenths
+static unsigned int RunRate(const unsigned char *p){
+    unsigned int units = GetBits(p, F_RUN_TIME);
+    unsigned char bottles = GetBits(p, F_CAP_YOP) + GetBits(p, F_NOCAP_YOP) +
+                            GetBits(p, F_CAP_ESKA) + GetBits(p, F_NOCAP_ESKA);
+    if (units == 0){
+        return 0;
+    }
+    return (unsigned int)(bottles * 60000UL / units);
+}
+
+//Adds (sign 1) or takes away (sign -1) one run's share of the totals
+static void StatsUpdate(const unsigned char *p, signed char sign){
+    stats.runs += sign;
+    stats.cap_yop += sign * (int)GetBits(p, F_CAP_YOP);
+    stats.nocap_yop += sign * (int)GetBits(p, F_NOCAP_YOP);
+    stats.cap_eska += sign * (int)GetBits(p, F_CAP_ESKA);
+    stats.nocap_eska += sign * (int)GetBits(p, F_NOCAP_ESKA);
+    stats.run_ms += sign * (long)GetBits(p, F_RUN_TIME) * 10;
+}
+
+//Best rate over the visible runs
+static void StatsBest(void){
+    stats.best_rate = 0;
+    for (unsigned char run = 1; run <= count; run++){
+        unsigned int rate = RunRate(run_index[RunSlot(run)]);
+        if (rate > stats.best_rate){
+            stats.best_rate = rate;
+        }
+    }
+}
+
+static void StatsRebuild(void){
+    stats.runs = 0;
+    stats.cap_yop = 0;
+    stats.nocap_yop = 0;
+    stats.cap_eska = 0;
+    stats.nocap_eska = 0;
+    stats.run_ms = 0;
+    for (unsigned char run = 1; run <= count; run++){
+        StatsUpdate(run_index[RunSlot(run)], 1);
+    }
+    StatsBest();
+}
+
+//! @brief      Finds the head of the ring, call once at start-up.
+void JournalInit(void){
+    unsigned char rec[JOURNAL_PROFILE];
+    unsigned char seq0, lo, hi, mid;
+
+    //Slots 0..h-1 hold valid records numbered on from slot 0's; slot h is
+    //empty, torn or left over from the previous pass. That makes "valid and
+    //in sequence with slot 0" true up to h and false after it.
+    lo = 0;
+    hi = JOURNAL_SLOTS;
+    if (ReadSlot(0, rec)){
+        seq0 = rec[0];
+        lo = 1;
+        while (lo < hi){
+            mid = (lo + hi) / 2;
+            if (ReadSlot(mid, rec) && rec[0] == (unsigned char)(seq0 + mid)){
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+    }
+
+    if (lo < JOURNAL_SLOTS && SlotValid(lo)){
+        count = JOURNAL_SLOTS;              //Wrapped, slot h is the oldest run
+    } else if (lo + 1 < JOURNAL_SLOTS && SlotValid(lo + 1)){
+        count = JOURNAL_SLOTS - 1;          //Wrapped, and the write to slot h was cut short
+    } else {
+        count = lo;
+    }
+    head = lo % JOURNAL_SLOTS;
+
+    next_seq = 0;
+    if (count){
+        ReadSlot((head + JOURNAL_SLOTS - 1) % JOURNAL_SLOTS, rec);
+        next_seq = rec[0] + 1;
+    }
+
+    //Hide the runs up to the clear mark
+    unsigned char mark = Eeprom_ReadByte(CLEAR_MARK);
+    clear_marked = (unsigned char)~mark == (unsigned char)Eeprom_ReadByte(CLEAR_MARK + 1);
+    if (clear_marked){
+        unsigned char since = next_seq - 1 - mark;
+        if (since < count){
+            count = since;
+        }
+    }
+
+    //Load the index; a run that no longer checks out reads as all zero
+    for (unsigned char run = 1; run <= count; run++){
+        unsigned char slot = RunSlot(run);
+        if (!ReadSlot(slot, rec)){
+            for (unsigned char i = 1; i <= PAYLOAD; i++){
+                rec[i] = 0;
+            }
+        }
+        for (unsigned char i = 0; i < PAYLOAD; i++){
+            run_index[slot][i] = rec[i + 1];
+        }
+    }
+    StatsRebuild();
+
+    for (unsigned char i = 0; i < JOURNAL_PROFILES; i++){
+        prof_valid[i] = ReadProfileSlot(i, rec);
+        prof_seq[i] = rec[0];
+    }
+}
+
+//! @returns    Number of runs stored, up to JOURNAL_SLOTS.
+unsigned char JournalCount(void){
+    return count;
+}
+
+//! @returns    Sequence number of the newest run written. It changes with
+//!             every run, so together with JournalCount() it tells one
+//!             state of the log from another even once the ring is full.
+unsigned char JournalNewest(void){
+    return next_seq - 1;
+}
+
+//! @brief      Reads a stored run from the RAM index.
+//! @param      run     1 for the oldest up to JournalCount() for the newest
+//! @returns    false if there is no such run.
+bool JournalRead(unsigned char run, run_t *r){
+    const unsigned char *rec;
+
+    if (run == 0 || run > count){
+        return false;
+    }
+    rec = run_index[RunSlot(run)];
+    r->time[CLOCK_YEAR] = BinToBcd(GetBits(rec, F_YEAR));
+    r->time[CLOCK_MONTH] = BinToBcd(GetBits(rec, F_MONTH));
+    r->time[CLOCK_DAY] = BinToBcd(GetBits(rec, F_DAY));
+    r->time[CLOCK_WEEKDAY] = 0;
+    r->time[CLOCK_HOUR] = BinToBcd(GetBits(rec, F_HOUR));
+    r->time[CLOCK_MIN] = BinToBcd(GetBits(rec, F_MIN));
+    r->time[CLOCK_SEC] = BinToBcd(GetBits(rec, F_SEC));
+    r->run_ms = GetBits(rec, F_RUN_TIME) * 10UL;
+    r->cap_yop = GetBits(rec, F_CAP_YOP);
+    r->nocap_yop = GetBits(rec, F_NOCAP_YOP);
+    r->cap_eska = GetBits(rec, F_CAP_ESKA);
+    r->nocap_eska = GetBits(rec, F_NOCAP_ESKA);
+    return true;
+}
+
+//! @brief      Reads the phase profile of a stored run from the EEPROM.
+//! @param      run     1 for the oldest up to JournalCount() for the newest
+//! @returns    false, with the profile all zero, if there is no such run,
+//!             it is older than the last JOURNAL_PROFILES runs or its
+//!             profile no longer checks out.
+bool JournalProfile(unsigned char run, profile_t *p){
+    unsigned char rec[JOURNAL_PROFILE];
+    unsigned char *dst = (unsigned char *)p;
+    unsigned char slot = run != 0 && run <= count ? ProfileSlot(RunSeq(run)) : JOURNAL_PROFILES;
+    bool ok = slot < JOURNAL_PROFILES && ReadProfileSlot(slot, rec);
+
+    for (unsigned char i = 0; i < sizeof(profile_t); i++){
+        dst[i] = ok ? rec[1 + i] : 0;
+    }
+    return ok;
+}
+
+//! @brief      Queues a run and its phase profile for writing over the
+//!             oldest slot.
+//! @note       Counts above 15 and run times above JOURNAL_MAX_MS are clamped.
+void JournalAppend(const run_t *r, const profile_t *prof){
+    unsigned char rec[JOURNAL_RECORD] = { 0 };
+    unsigned char prof_rec[JOURNAL_PROFILE];
+    unsigned char *p = rec + 1;
+    const unsigned char *src = (const unsigned char *)prof;
+    unsigned char slot;
+    bool best_lost = false;
+    unsigned long ms = r->run_ms < JOURNAL_MAX_MS ? r->run_ms : JOURNAL_MAX_MS;
+
+    rec[0] = next_seq;
+    PutBits(p, F_YEAR, BcdToBin(r->time[CLOCK_YEAR]));
+    PutBits(p, F_MONTH, BcdToBin(r->time[CLOCK_MONTH]));
+    PutBits(p, F_DAY, BcdToBin(r->time[CLOCK_DAY]));
+    PutBits(p, F_HOUR, BcdToBin(r->time[CLOCK_HOUR]));
+    PutBits(p, F_MIN, BcdToBin(r->time[CLOCK_MIN]));
+    PutBits(p, F_SEC, BcdToBin(r->time[CLOCK_SEC]));
+    PutBits(p, F_RUN_TIME, (unsigned int)((ms + 5) / 10));
+    PutBits(p, F_CAP_YOP, r->cap_yop < 15 ? r->cap_yop : 15);
+    PutBits(p, F_NOCAP_YOP, r->nocap_yop < 15 ? r->nocap_yop : 15);
+    PutBits(p, F_CAP_ESKA, r->cap_eska < 15 ? r->cap_eska : 15);
+    PutBits(p, F_NOCAP_ESKA, r->nocap_eska < 15 ? r->nocap_eska : 15);
+    rec[JOURNAL_RECORD - 1] = Crc8(rec, JOURNAL_RECORD - 1);
+    Eeprom_QueueRecord(head * JOURNAL_RECORD, rec, JOURNAL_RECORD);
+
+    slot = OldestProfile();
+    prof_rec[0] = next_seq;
+    for (unsigned char i = 0; i < sizeof(profile_t); i++){
+        prof_rec[1 + i] = src[i];
+    }
+    prof_rec[JOURNAL_PROFILE - 1] = Crc8(prof_rec, JOURNAL_PROFILE - 1);
+    Eeprom_QueueRecord(PROFILE_AT + slot * JOURNAL_PROFILE, prof_rec, JOURNAL_PROFILE);
+    prof_seq[slot] = next_seq;
+    prof_valid[slot] = 1;
+
+    if (count == JOURNAL_SLOTS){
+        //The oldest run drops out of the totals
+        best_lost = RunRate(run_index[head]) == stats.best_rate;
+        StatsUpdate(run_index[head], -1);
+        count--;
+    }
+    for (unsigned char i = 0; i < PAYLOAD; i++){
+        run_index[head][i] = p[i];
+    }
+    head = (head + 1) % JOURNAL_SLOTS;
+    next_seq++;
+    count++;
+    StatsUpdate(p, 1);
+    if (best_lost){
+        StatsBest();
+    } else if (RunRate(p) > stats.best_rate){
+        stats.best_rate = RunRate(p);
+    }
+    if (clear_marked && count == JOURNAL_SLOTS){
+        //Every run it hid is overwritten; drop it before the sequence
+        //numbers come round to it again
+        Eeprom_QueueByte(CLEAR_MARK + 1, Eeprom_ReadByte(CLEAR_MARK));
+        clear_marked = 0;
+    }
+}
+
+//! @brief      Hides every stored run. The records stay in place and are
+//!             overwritten by later runs as usual.
+void JournalClear(void){
+    unsigned char mark = next_seq - 1;
+    Eeprom_QueueByte(CLEAR_MARK, mark);
+    Eeprom_QueueByte(CLEAR_MARK + 1, ~mark);
+    clear_marked = 1;
+    count = 0;
+    StatsRebuild();
+}
+
+//! @returns    Totals over the stored runs.
+const journal_stats_t *JournalStats(void){
+    return &stats;
+}
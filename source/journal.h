@@ -0,0 +1,54 @@
+/*
+ * File:   journal.h
+ */
+
+#ifndef JOURNAL_H
+#define	JOURNAL_H
+
+#include <stdbool.h>
+#include "profile.h"
+
+//The data EEPROM is a ring of fixed size run records. Each one carries a
+//sequence number and a CRC, so the newest is found at start-up and the
+//oldest is overwritten once the ring is full. The phase profiles of the
+//newest runs are kept in a second, smaller ring after it.
+#define JOURNAL_RECORD      10
+#define JOURNAL_SLOTS       76      //760 bytes
+#define JOURNAL_PROFILE     26      //Sequence number of the run, profile_t, CRC-8
+#define JOURNAL_PROFILES    10      //260 bytes, the last four after them hold the clear mark
+#define JOURNAL_MAX_MS      327670UL
+
+//One run as the firmware sees it
+typedef struct {
+    unsigned char time[7];          //Start time, DS1307 register order (BCD)
+    unsigned long run_ms;           //Kept to 10 ms
+    unsigned char cap_yop;
+    unsigned char nocap_yop;
+    unsigned char cap_eska;
+    unsigned char nocap_eska;
+} run_t;
+
+//Totals over the stored runs, kept up to date as runs are added
+typedef struct {
+    unsigned char runs;
+    unsigned int cap_yop;
+    unsigned int nocap_yop;
+    unsigned int cap_eska;
+    unsigned int nocap_eska;
+    unsigned long run_ms;           //Sum of the run times
+    unsigned int best_rate;         //Best bottles per minute, in tenths
+} journal_stats_t;
+
+#define RUN_BOTTLES(r)      ((r)->cap_yop + (r)->nocap_yop + (r)->cap_eska + (r)->nocap_eska)
+
+void JournalInit(void);
+unsigned char JournalCount(void);
+unsigned char JournalNewest(void);
+bool JournalRead(unsigned char run, run_t *r);
+bool JournalProfile(unsigned char run, profile_t *p);
+void JournalAppend(const run_t *r, const profile_t *p);
+void JournalClear(void);
+const journal_stats_t *JournalStats(void);
+unsigned char Crc8(const unsigned char *p, unsigned char len);
+
+#endif	/* JOURNAL_H */
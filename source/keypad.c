@@ -0,0 +1,41 @@
+/*
+ * File:   keypad.c
+ */
+
+#include <xc.h>
+#include "constants.h"
+#include "keypad.h"
+
+//The ISR only latches the encoder code; the menus read it from the main
+//loop. The ISR writes head and the main loop tail, so neither side has to
+//mask the other.
+static volatile unsigned char queue[KEYPAD_QUEUE_LEN];
+static volatile unsigned char head, tail;
+
+void KeypadInit(void){
+    head = tail = 0;
+    INT1IF = 0;
+    INT1IE = 1;
+}
+
+//! @brief      Takes the oldest key press.
+//! @param      key gets the encoder code, KEY_A and so on
+//! @returns    false if no key is waiting.
+bool KeypadGet(unsigned char *key){
+    if (head == tail){
+        return false;
+    }
+    *key = queue[tail];
+    tail = (tail + 1) & (KEYPAD_QUEUE_LEN - 1);
+    return true;
+}
+
+//! @brief      Called from the ISR on INT1IF, when the encoder has a key.
+void KeypadISR(void){
+    unsigned char next = (head + 1) & (KEYPAD_QUEUE_LEN - 1);
+    if (next != tail){
+        queue[head] = KEYPAD_DATA;
+        head = next;
+    }
+    INT1IF = 0;
+}
@@ -0,0 +1,26 @@
+/*
+ * File:   keypad.h
+ */
+
+#ifndef KEYPAD_H
+#define	KEYPAD_H
+
+#include <stdbool.h>
+
+#define KEYPAD_QUEUE_LEN    8       //Presses waiting for the main loop, a power of two
+
+//Encoder codes, the keys read row by row: 1 2 3 A / 4 5 6 B / 7 8 9 C / * 0 # D
+#define KEYPAD_KEYS         16
+#define KEY_A               3
+#define KEY_B               7
+#define KEY_C               11
+#define KEY_STAR            12
+#define KEY_0               13
+#define KEY_HASH            14
+#define KEY_D               15
+
+void KeypadInit(void);
+bool KeypadGet(unsigned char *key);
+void KeypadISR(void);
+
+#endif	/* KEYPAD_H */
@@ -4,54 +4,203 @@
 
 #include <xc.h>
 #include "configBits.h"
-#include <stdio.h>
 #include "lcd.h"
 #include "constants.h"
 
+//Screens are drawn into fb; LcdFlush() copies the cells that differ from
+//what the display shows (shown) a few at a time, so drawing never waits
+//on the display.
+static char fb[LCD_ROWS][LCD_COLS];
+static char shown[LCD_ROWS][LCD_COLS];
+static unsigned char cur_row, cur_col;      //where putch() writes next
+static bool cursor_on, cursor_shown;
+static unsigned char addr;                  //display's DDRAM address counter
+
+#define DDRAM(row, col)     ((row) * 0x40 + (col))
+
+//HD44780 execution times: 37 us and 1.52 ms at 270 kHz, with margin for
+//a controller running at the slow end of its range
+#define LCD_EXEC_US         50
+#define LCD_EXEC_LONG_US    2000    //clear display and return home
+
+//Clocks one nibble (D4-D7) in on the falling edge of E
+static void Nibble(unsigned char n){
+    LCD_PORT = (LCD_PORT & 0x0F) | (n & 0xF0);
+    E = 1;
+    __delay_us(1);      //E pulse width, 450 ns minimum
+    E = 0;
+    __delay_us(1);      //E cycle time, 1 us minimum
+}
+
+#if LCD_READBACK
+//Polls the busy flag. Each read is two nibbles; the second one holds the
+//low half of the address counter, which is not needed.
+static void WaitReady(void){
+    bool busy;
+    TRISD = TRISD | 0xF0;
+    RS = 0;
+    LCD_RW = 1;
+    do {
+        E = 1;
+        __delay_us(1);
+        busy = PORTDbits.RD7;
+        E = 0;
+        __delay_us(1);
+        E = 1;
+        __delay_us(1);
+        E = 0;
+        __delay_us(1);
+    } while (busy);
+    LCD_RW = 0;
+    TRISD = TRISD & 0x0F;
+}
+#endif
+
+//Sends a byte in two nibbles. With LCD_READBACK the busy flag is checked
+//before the write, so the controller executes while the caller goes on;
+//otherwise the write is followed by the instruction's worst case time.
+static void Send(bool rs, unsigned char data){
+#if LCD_READBACK
+    WaitReady();
+#endif
+    RS = rs;
+    Nibble(data);
+    Nibble(data << 4);
+#if !LCD_READBACK
+    if (!rs && data < 0x04){
+        __delay_us(LCD_EXEC_LONG_US);
+    } else {
+        __delay_us(LCD_EXEC_US);
+    }
+#endif
+}
+
 void initLCD(void) {
-    __delay_ms(15);
-    lcdInst(0b00110011);
-    lcdInst(0b00110010);
-    lcdInst(0b00101000);
-    lcdInst(0b00001100);
-    lcdInst(0b00000110);
-    lcdInst(0b00000001);
-    __delay_ms(15);
+    //Initialisation by instruction, datasheet figure 24. The controller
+    //may be in either interface mode until the fourth write, so these
+    //waits are fixed even with LCD_READBACK.
+#if LCD_READBACK
+    TRISEbits.TRISE2 = 0;
+#endif
+    LCD_RW = 0;
+    E = 0;
+    __delay_ms(40);
+    RS = 0;
+    Nibble(0x30);
+    __delay_ms(5);
+    Nibble(0x30);
+    __delay_us(150);
+    Nibble(0x30);
+    __delay_us(LCD_EXEC_US);
+    Nibble(0x20);       //4-bit interface
+    __delay_us(LCD_EXEC_US);
+    lcdInst(0b00101000);    //2 lines, 5x8 font
+    lcdInst(0b00001100);    //Display on, cursor off
+    lcdInst(0b00000110);    //Address increments, no shift
+    lcdInst(0b00000001);    //Clear
+
+    for (unsigned char r = 0; r < LCD_ROWS; r++){
+        for (unsigned char c = 0; c < LCD_COLS; c++){
+            fb[r][c] = ' ';
+            shown[r][c] = ' ';
+        }
+    }
+    cur_row = 0;
+    cur_col = 0;
+    cursor_on = 0;
+    cursor_shown = 0;
+    addr = DDRAM(0, 0);
 }
 
 void lcdInst(char data) {
-    RS = 0;
-    lcdNibble(data);
+    Send(0, data);
 }
 
+//Writes one character to the framebuffer at the write position
 void putch(char data){
-    RS = 1;
-    lcdNibble(data);
+    if (cur_col < LCD_COLS){
+        fb[cur_row][cur_col++] = data;
+    }
 }
 
-void lcdNibble(char data){
-    // Send of 4 most sig bits, then the 4 least sig bits (MSD,LSD)
-    char temp = data & 0xF0;
-    LATD = LATD & 0x0F;
-    LATD = temp | LATD;
+void LcdClear(void){
+    for (unsigned char r = 0; r < LCD_ROWS; r++){
+        for (unsigned char c = 0; c < LCD_COLS; c++){
+            fb[r][c] = ' ';
+        }
+    }
+    cur_row = 0;
+    cur_col = 0;
+}
 
-    E = 0;
-    __delay_us(LCD_DELAY);
-    E = 1;    
-    __delay_us(LCD_DELAY);
-    
-    data = data << 4;
-    
-    temp = data & 0xF0;
-    LATD = LATD & 0x0F;
-    LATD = temp | LATD;
+//! @brief      Blanks the rest of the current row from the write position.
+void LcdClearEol(void){
+    while (cur_col < LCD_COLS){
+        fb[cur_row][cur_col++] = ' ';
+    }
+}
 
-    E = 0;
-    __delay_us(LCD_DELAY);
-    E = 1;
-    __delay_us(LCD_DELAY);
+void LcdGoto(unsigned char row, unsigned char col){
+    cur_row = row;
+    cur_col = col;
 }
 
+//! @brief      Moves the write position along the current row.
+void LcdMove(signed char n){
+    signed char col = (signed char)cur_col + n;
+    if (col < 0){
+        col = 0;
+    }
+    cur_col = (unsigned char)col;
+}
 
+void LcdPuts(unsigned char row, unsigned char col, const char *s){
+    LcdGoto(row, col);
+    while (*s){
+        putch(*s++);
+    }
+}
 
+//! @brief      Shows a blinking cursor at the write position.
+void LcdCursor(bool on){
+    cursor_on = on;
+}
 
+static void WriteCell(unsigned char r, unsigned char c){
+    if (addr != DDRAM(r, c)){
+        lcdInst(0x80 | DDRAM(r, c));
+    }
+    Send(1, fb[r][c]);
+    shown[r][c] = fb[r][c];
+    addr = DDRAM(r, c) + 1;
+}
+
+//! @brief      Copies up to LCD_FLUSH_CHARS changed cells to the display,
+//!             then places the cursor. Runs as a scheduler task.
+void LcdFlush(void){
+    bool pending = 0;
+    unsigned char n = 0;
+
+    for (unsigned char r = 0; r < LCD_ROWS; r++){
+        for (unsigned char c = 0; c < LCD_COLS; c++){
+            if (fb[r][c] != shown[r][c]){
+                if (n < LCD_FLUSH_CHARS){
+                    WriteCell(r, c);
+                    n++;
+                } else {
+                    pending = 1;
+                }
+            }
+        }
+    }
+    if (!pending){
+        if (cursor_on != cursor_shown){
+            lcdInst(cursor_on ? 0b00001111 : 0b00001100);
+            cursor_shown = cursor_on;
+        }
+        if (cursor_on && cur_col < LCD_COLS && addr != DDRAM(cur_row, cur_col)){
+            addr = DDRAM(cur_row, cur_col);
+            lcdInst(0x80 | addr);
+        }
+    }
+}
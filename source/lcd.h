@@ -5,9 +5,22 @@
 #ifndef LCD_H
 #define	LCD_H
 
+#include <stdbool.h>
+
+#define LCD_ROWS        2
+#define LCD_COLS        16
+#define LCD_FLUSH_CHARS 4       //cells LcdFlush() writes per call
+
 void lcdInst(char data);
-void lcdNibble(char data);
 void initLCD(void);
+void putch(char data);
 
-#endif	/* LCD_H */
+void LcdClear(void);
+void LcdClearEol(void);
+void LcdGoto(unsigned char row, unsigned char col);
+void LcdMove(signed char n);
+void LcdPuts(unsigned char row, unsigned char col, const char *s);
+void LcdCursor(bool on);
+void LcdFlush(void);
 
+#endif	/* LCD_H */
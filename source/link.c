@@ -0,0 +1,120 @@
+/*
+ * File:   link.c
+ */
+
+#include <xc.h>
+#include "constants.h"
+#include "scheduler.h"
+#include "uart.h"
+#include "clock.h"
+#include "journal.h"
+#include "export.h"
+#include "profile.h"
+#include "link.h"
+
+#define LINK_GAP_MS         50      //A request stalled this long is dropped
+
+static unsigned char rx[3 + LINK_MAX_PAYLOAD + 1];   //command, len, payload, CRC
+static unsigned char rx_len;
+static unsigned int rx_last;
+static unsigned char tx[5 + LINK_MAX_PAYLOAD];
+static unsigned char tx_len, tx_sent;
+
+//Collects a request byte, true once a whole one is in rx
+static bool Receive(unsigned char c){
+    if (rx_len && (unsigned int)(SchedTicks() - rx_last) > LINK_GAP_MS){
+        rx_len = 0;
+    }
+    rx_last = SchedTicks();
+    if (rx_len == 0){
+        if (c == LINK_SOF){
+            rx_len = 1;
+        }
+        return false;
+    }
+    rx[rx_len - 1] = c;
+    rx_len++;
+    if (rx_len == 3 && rx[1] > LINK_MAX_PAYLOAD){
+        rx_len = 0;                 //Cannot be one of ours, wait for the next SOF
+        return false;
+    }
+    if (rx_len >= 4 && rx_len == rx[1] + 4){
+        rx_len = 0;
+        return true;
+    }
+    return false;
+}
+
+//Starts the answer in tx, the caller appends the payload
+static unsigned char *Reply(unsigned char cmd, unsigned char len){
+    tx[0] = LINK_SOF;
+    tx[1] = cmd | LINK_REPLY;
+    tx[2] = len;
+    tx_len = len + 4;
+    return tx + 3;
+}
+
+static void Handle(void){
+    unsigned char cmd = rx[0], len = rx[1];
+    unsigned char *req = rx + 2, *p;
+    unsigned long baud = UART_BAUD;
+
+    if (Crc8(rx, len + 2) != req[len]){
+        Reply(LINK_ERROR, 1)[0] = cmd;
+    } else if (cmd == LINK_INFO && len == 0){
+        p = Reply(cmd, 10);
+        p[0] = LINK_VERSION;
+        p[1] = EXPORT_VERSION;
+        p[2] = JOURNAL_SLOTS;
+        p[3] = JournalCount();
+        p[4] = PIPELINE_RUN;
+        p[5] = LCD_READBACK;
+        for (unsigned char i = 6; i < 10; i++){
+            p[i] = baud;
+            baud >>= 8;
+        }
+    } else if (cmd == LINK_STATUS && len == 0){
+        RunStatus(Reply(cmd, LINK_STATUS_LEN));
+    } else if (cmd == LINK_GET_TIME && len == 0){
+        ClockNow(Reply(cmd, 7));
+    } else if (cmd == LINK_SET_TIME && len == 7){
+        //ClockSet waits for the bus, a few ms at most
+        bool ok = ClockSet(req);
+        Reply(cmd, 1)[0] = ok;
+    } else if (cmd == LINK_LOG && len == 1){
+        p = Reply(cmd, 1 + EXPORT_RECORD);
+        p[0] = req[0];
+        ExportRecord(req[0], p + 1);
+    } else if (cmd == LINK_PROFILE && len == 1){
+        const unsigned char *d = ProfileBottle(req[0]);
+        p = Reply(cmd, 2 + PROF_PHASES);
+        p[0] = req[0];
+        p[1] = ProfileBottles();
+        for (unsigned char i = 0; i < PROF_PHASES; i++){
+            p[2 + i] = req[0] < ProfileBottles() ? d[i] : 0;
+        }
+    } else {
+        Reply(LINK_ERROR, 1)[0] = cmd;
+    }
+    tx[tx_len - 1] = Crc8(tx + 1, tx_len - 2);
+    tx_sent = 0;
+}
+
+//! @brief      Serves the link, one request at a time.
+void LinkTask(void){
+    unsigned char c;
+
+    //Finish the last answer before taking the next request
+    while (tx_sent < tx_len){
+        if (!UartPut(tx[tx_sent])){
+            return;
+        }
+        tx_sent++;
+    }
+    while (UartGet(&c)){
+        if (Receive(c)){
+            Handle();
+            return;
+        }
+    }
+}
@@ -0,0 +1,40 @@
+/*
+ * File:   link.h
+ */
+
+#ifndef LINK_H
+#define	LINK_H
+
+//Binary command link to the PC over the EUSART (UART_LINK builds). A
+//request is
+//
+//  0xA5, command, len, payload[len], CRC-8 of command..payload
+//
+//and the answer has the same shape with bit 7 of the command set. An
+//unknown or malformed command is answered with LINK_ERROR carrying the
+//command byte. Frames are served from the scheduler, so the link works
+//while a run is in progress.
+#define LINK_VERSION        2
+#define LINK_SOF            0xA5
+#define LINK_REPLY          0x80
+#define LINK_MAX_PAYLOAD    48
+
+#define LINK_INFO           0x01    //-> version, export version, journal slots, runs stored,
+                                    //   PIPELINE_RUN, LCD_READBACK, baud (4 bytes)
+#define LINK_STATUS         0x02    //-> live counters, see RunStatus()
+#define LINK_GET_TIME       0x03    //-> seven DS1307 registers
+#define LINK_SET_TIME       0x04    //seven DS1307 registers -> 1 if the RTC took them
+#define LINK_LOG            0x05    //run -> run, 40-byte record as in the log export
+#define LINK_PROFILE        0x06    //bottle -> bottle, bottles completed, phase durations
+                                    //   of that bottle in the current run (profile.h)
+#define LINK_ERROR          0x7F
+
+#define LINK_STATUS_LEN     12
+
+void LinkTask(void);
+
+//Supplied by main.c: state, running flag, bottles, the four counts, run
+//time so far in ms (4 bytes, low first) and the sensor snapshot
+void RunStatus(unsigned char *buf);
+
+#endif	/* LINK_H */
@@ -3,21 +3,35 @@
  */
 
 #include <xc.h>
-#include <stdio.h>
 #include "configBits.h"
 #include "constants.h"
 #include "lcd.h"
 #include "I2C.h"
+#include "keypad.h"
 #include "eeprom.h"
-
-#define __delay_1s() for(char i=0;i<100;i++){__delay_ms(10);}
-#define __lcd_newline() lcdInst(0b11000000);
-#define __lcd_clear() lcdInst(0x01);
-#define __lcd_home() lcdInst(0b10000000);
-#define __lcd_cursor_back() lcdInst(0b00010000);
-#define __lcd_cursor_next() lcdInst(0b00010100);
-#define __bcd_to_num(num) (num & 0x0F) + ((num & 0xF0)>>4)*10
-#define __btm(num) (num & 0x0F) + ((num & 0xF0)>>4)*10
+#include "journal.h"
+#include "export.h"
+#include "uart.h"
+#include "link.h"
+#include "scheduler.h"
+#include "stepper.h"
+#include "servo.h"
+#include "stages.h"
+#include "profile.h"
+#include "classify.h"
+#include "centrifuge.h"
+#include "sensors.h"
+#include "clock.h"
+#include "format.h"
+
+#define __lcd_newline() LcdGoto(1, 0);
+#define __lcd_clear() LcdClear();
+#define __lcd_home() LcdGoto(0, 0);
+#define __lcd_cursor_back() LcdMove(-1);
+#define __lcd_cursor_next() LcdMove(1);
+
+#define RUN_TIME_LIMIT_MS   165000UL
+#define NO_BOTTLE_LIMIT_MS  8400UL      //21000 passes of the old loop at about 0.4 ms
 
 #define STATE_STOPPED 0
 #define STATE_MAIN_MENU 1
@@ -29,6 +43,7 @@
 #define STATE_CLEAR_LOGS 7
 #define STATE_SEND_LOGS 8
 #define STATE_SET_TIME 9
+#define STATE_ALL_STATS 10
 
 void SortDone(void);
 void __lcd_new(void);
@@ -36,21 +51,27 @@ void StepperMotorRotateUpSlow(void);
 void StepperMotorRotateUpFast(void);
 void StepperMotorRotateDown1to2(void);
 void StepperMotorRotateDown2to3(void);
-void BinMotorMoveTo(char n);
+bool CarriageHomed(void);
+void ClockTask(void);
+void DetectTask(void);
+void ClassifyTask(void);
+void DropTask(void);
+void CentrifugeTask(void);
+void LogTask(void);
+void KeyTask(void);
+void UiKey(unsigned char key);
+void UiGoto(unsigned char next);
+void MainMenuDraw(void);
+void AllStatsPage(unsigned char page);
+void ProfilePage(unsigned char phase);
 
-const char keys[] = "123A456B789C*0#D"; 
 char state = STATE_MAIN_MENU;
 
-char CCW[8] = {0x09,0x01,0x03,0x02,0x06,0x04,0x0c,0x08};
-char CW[8] = {0x08,0x0c,0x04,0x06,0x02,0x03,0x01,0x09}; 
 
 unsigned char set_time[13];
 unsigned char set_time_cursor;
-unsigned char num_entered;
 
 unsigned char time[7];
-unsigned char end_time[7];
-unsigned char curr_time_elapsed[7];
 
 unsigned char move_to;
 
@@ -63,15 +84,34 @@ unsigned char bottle_count;
 unsigned char bottle_existence_flag;
 
 bool bottle_type_flag; //1 is Yop, 0 is Eska
-bool edge_side_sensor_flag;
-bool post_side_sensor_flag;
+unsigned char detect_sample;    //Sample counts of the classifier votes
+unsigned char classify_sample;
 
 unsigned long no_bottle_time; 
+unsigned long no_bottle_start;
+bool waiting_for_bottle;
+
+int MotorPos; //Position the carriage is at or moving to
+unsigned long run_start;    //SchedMillis() when the run started
+unsigned long run_time_ms;
+unsigned long clock_shown;  //ClockSeconds() on the main menu display
+
+task_t clock_task;
+task_t detect_task;
+task_t classify_task;
+task_t drop_task;
+task_t log_task;
+task_t key_task;
+
+bool log_sending;
+bool message_shown;          //Hold the screen a second before the main menu
 
 unsigned char run_selected;
 unsigned char stat_selected;
-
-unsigned char num_runs_stored;
+run_t log_run;              //The run on the log screens
+profile_t log_profile;
+bool log_profiled;          //Only the newest runs keep a profile
+unsigned char prof_selected;
 
 bool emergency_flag;
 
@@ -84,873 +124,933 @@ void main(void) {
     TRISB = 0xFF; //Set Port B as all input
     TRISC = 0x00; //Set Port C 
     TRISD = 0b00000011; //Set Port D
+#if UART_LINK
+    TRISBbits.TRISB3 = 0;   //Post and top sensor supplies
+    TRISAbits.TRISA7 = 0;
+#endif
     
-    I2C_Master_Init(10000); //Initialize I2C Master with 100KHz clock
+    I2C_Master_Init(100000); //Initialize I2C Master with 100KHz clock
     LATB = 0x00; 
     LATA = 0x00;      
-    LATCbits.LC2 = 0;
-    LATCbits.LC1 = 0;
+    CentrifugeInit();
 
     ADCON0 = 0x00;  //Disable ADC
     ADCON1 = 0b00001111;  //Sets all inputs to be digital instead of analog   
     initLCD();
-    INT1IE = 1;
+    KeypadInit();
+    Eeprom_Init();
     ei();           //Enable all interrupts
+#if UART_LINK
+    UartInit();     //Only once the ISR can empty the two byte receive FIFO
+#endif
     
-    num_runs_stored = Eeprom_ReadByte(0x00);
-    if (num_runs_stored == 255){
-        num_runs_stored = 0;
-        Eeprom_WriteByte(0x00, num_runs_stored);
-    }
+    JournalInit();
     
     time[0] = 0;
-    end_time[0] = 0;
 
-    char MotorPos = 1;
+    MotorPos = STEPPER_UNHOMED;
     no_bottle_time = 0;
     
-    LATCbits.LC7 = 1;
+    TOP_SENSOR_PWR = 1;
+
+    SensorsInit();
+    StepperInit();
+    BinServoInit();
+
+    //Everything after start-up runs as cooperative tasks, see scheduler.h
+    SchedInit();
+    ClockInit();    //Needs the tick for I2C timeouts
+    SchedAdd(CentrifugeTask);
+    SchedAdd(DetectTask);
+    SchedAdd(ClassifyTask);
+    SchedAdd(DropTask);
+    SchedAdd(ClockTask);
+    SchedAdd(KeyTask);
+    SchedAdd(LogTask);
+    SchedAdd(ExportTask);
+#if UART_LINK
+    SchedAdd(LinkTask);
+#endif
+    SchedAdd(LcdFlush);
 
+    while(1){
+        __loop_idle();
+        SchedRun();
+    }
+    return;
+}
+
+//Keeps the clock on the main menu up to date
+void ClockTask(void){
+    TASK_BEGIN(&clock_task);
     while(1){
         if (state == STATE_MAIN_MENU){
-            LATCbits.LC5 = 1; //RC5 Turns on Edge Sensor
-            LATCbits.LC6 = 1; //RC6 Turns on Post Sensor
-            LATCbits.LC7 = 1; //RC7 Turns on Top Sensor
-            
-            //Update time:          
-            I2C_Master_Start(); 
-            I2C_Master_Write(0b11010000); 
-            I2C_Master_Write(0x00); 
-            I2C_Master_Stop(); 
-            
-            I2C_Master_Start();
-            I2C_Master_Write(0b11010001); 
-            for(unsigned char i=0;i<0x06;i++){
-                time[i] = I2C_Master_Read(1);
-            }
-            time[6] = I2C_Master_Read(0);       
-            I2C_Master_Stop();
-            __lcd_home();
-            
-            if (time[5] > 9){
-                printf("%02x%02x-%02x %02x:%02x:%02x", time[6],time[5],time[4],time[2],time[1],time[0]);
-            } else {
-                printf("%02x-%x-%02x %02x:%02x:%02x", time[6],time[5],time[4],time[2],time[1],time[0]);
-            }
-            __lcd_newline();
-            printf("A:START B:LOGS  ");
-            __delay_1s();
+            EDGE_SENSOR_PWR = 1; //RC5 Turns on Edge Sensor
+            POST_SENSOR_PWR = 1; //RC6 Turns on Post Sensor
+            TOP_SENSOR_PWR = 1; //RC7 Turns on Top Sensor
+            MainMenuDraw();
         }
+        clock_shown = ClockSeconds();
+        TASK_WAIT_UNTIL(&clock_task, ClockSeconds() != clock_shown);
+    }
+    TASK_END(&clock_task);
+}
 
-        if (state == STATE_RUNNING){
-            I2C_Master_Start(); //Start condition
-            I2C_Master_Write(0b11010000); //7 bit RTC address + Write
-            I2C_Master_Write(0x00); //Set memory pointer to seconds
-            I2C_Master_Stop(); //Stop condition
-
-            //Read Current Time
-            I2C_Master_Start();
-            I2C_Master_Write(0b11010001); //7 bit RTC address + Read
-            for(unsigned char i=0;i<0x06;i++){
-                end_time[i] = I2C_Master_Read(1);
-            }
-            time[6] = I2C_Master_Read(0);       //Final Read without ack
-            I2C_Master_Stop();
-
-            int time_elapsed = 0;
-            int endmin = __bcd_to_num(end_time[1]);
-            int endsec = __bcd_to_num(end_time[0]);
-            int min = __bcd_to_num(time[1]);
-            int sec = __bcd_to_num(time[0]);
-            int time_elapsed = ((endmin - min))*60 + (endsec - sec);
-            if ((endmin - min) < 0){
-                time_elapsed += 3600;
-            }
-            
-            //End at 3 minutes or once 10 bottles are sorted or we have a motor failure or jam
-            if (time_elapsed > 165 || bottle_count == 10 || emergency_flag){
-                SortDone();
-                continue;
-            }
-            
-            if (MotorPos == 1){
+//STEPPER_TOP: waits for a bottle and reads its type and edge sensor
+void DetectTask(void){
+    TASK_BEGIN(&detect_task);
+    TASK_WAIT_UNTIL(&detect_task, state == STATE_RUNNING);
 
-                LATCbits.LC5 = 0; 
-                LATCbits.LC6 = 0; 
-                LATCbits.LC7 = 1; //RC7 turns on existence sensor
+    StagesReset();
+    ProfileReset();
+    AgitateReset();
+    StepperMotorRotateUpFast(); //Ensuring stepper in correct starting position
+    MotorPos = STEPPER_TOP;
 
-            	if (PORTEbits.RE0 || bottle_existence_flag){ //RE0 is existence sensor
-                    no_bottle_time = 0;
-                    
-                    //Turn off centrifuge when bottle detected:
-                    LATCbits.LC2 = 0;
-                    LATCbits.LC1 = 0;
+    while(1){
+        //DropTask hands over as soon as the carriage starts back up
+        TASK_WAIT_UNTIL(&detect_task, MotorPos == STEPPER_TOP);
+
+#if PIPELINE_RUN
+        //Feed the next bottle while the carriage is still on its way up
+        if (bottle_count < 10){
+            StageBegin(STAGE_FEED);
+            no_bottle_start = SchedMillis();
+            waiting_for_bottle = 1;
+            AgitateStart();
+        }
+#endif
+        TASK_WAIT_UNTIL(&detect_task, CarriageHomed());
+        StageEnd(STAGE_RETURN);
+        ProfileBottleDone();
+
+        //End at 3 minutes or once 10 bottles are sorted or we have a motor failure or jam
+        if (SchedMillis() - run_start > RUN_TIME_LIMIT_MS || bottle_count == 10 || emergency_flag){
+            SortDone();
+            TASK_RESTART(&detect_task);
+        }
+
+        EDGE_SENSOR_PWR = 0; 
+        POST_SENSOR_PWR = 0; 
+        TOP_SENSOR_PWR = 1; //RC7 turns on existence sensor
+        ProfileMark(PROF_DETECT);
+
+        //The centrifuge task agitates the feed while we wait
+        if (!waiting_for_bottle){
+            StageBegin(STAGE_FEED);
+            no_bottle_start = SchedMillis();
+            waiting_for_bottle = 1;
+            AgitateStart();
+        }
+        TASK_WAIT_UNTIL(&detect_task, (Sensors() & SENSOR_EXIST) || bottle_existence_flag || SchedMillis() - run_start > RUN_TIME_LIMIT_MS); //RE0 is existence sensor
+        waiting_for_bottle = 0;
+        if (!(Sensors() & SENSOR_EXIST) && !bottle_existence_flag){
+            continue;
+        }
+        StageEnd(STAGE_FEED);
+        StageBegin(STAGE_TYPE);
+        ProfileMark(PROF_SENSE);
                     
-                    __lcd_new();
-                    printf("Bottle Detected");
+        //Turn off centrifuge when bottle detected:
+        AgitateFed(SchedMillis() - no_bottle_start);
+        no_bottle_time = 0;
                     
-                    __delay_ms(500);
+        __lcd_new();
+        FmtStr("Bottle Detected");
+        ClassifyStart();
                     
-                    //Detecting bottle type:
-                    while (1){
-                        bottle_type_flag = PORTEbits.RE1; //RE1 is type sensor
-                        __delay_ms(40);
-                        if (PORTEbits.RE1 == bottle_type_flag){
-                            break;
-                        }
-                    }
-                    __lcd_new();
-
-                    //Detecting appropriate edge sensor reading:
-                    LATCbits.LC5 = 1; //RC5 turns on edge side sensor
-                    LATCbits.LC6 = 0; 
-                    LATCbits.LC7 = 0;
+        //Let the bottle settle, then vote the type sensor
+        TASK_WAIT_MS(&detect_task, 500 - CLASS_SAMPLE_MS);
+        for (detect_sample = 0; detect_sample < CLASS_SAMPLES; detect_sample++){
+            TASK_WAIT_MS(&detect_task, CLASS_PERIOD_MS);
+            ClassifyVote(CLASS_TYPE, (SensorsRaw() & SENSOR_TYPE) != 0); //RE1 is type sensor
+        }
+        bottle_type_flag = ClassifyYop();
+        StageEnd(STAGE_TYPE);
+        __lcd_new();
+
+#if PIPELINE_RUN
+        //Head for the Yop or the Eska bins while the caps are checked
+        StageBegin(STAGE_SERVO);
+        if (bottle_type_flag){
+            BinServoTowards(1, 2);
+        } else {
+            BinServoTowards(3, 4);
+        }
+#endif
+
+        //Detecting appropriate edge sensor reading:
+        StageBegin(STAGE_EDGE);
+        EDGE_SENSOR_PWR = 1; //RC5 turns on edge side sensor
+        POST_SENSOR_PWR = 0; 
+        TOP_SENSOR_PWR = 0;
                         
-                    __delay_ms(600);
+        TASK_WAIT_MS(&detect_task, 600 - CLASS_SAMPLE_MS);
                     
-                    //RA4 and RA5 are connected to edge side sensors
-                    while(1){
-                        if (bottle_type_flag){
-                            edge_side_sensor_flag = PORTAbits.RA4;
-                            __delay_ms(40);
-                            if (PORTAbits.RA4 == edge_side_sensor_flag){
-                                break;
-                            }
-                        }
-                        else {
-                            edge_side_sensor_flag = PORTAbits.RA5;
-                            __delay_ms(40);
-                            if (PORTAbits.RA5 == edge_side_sensor_flag){
-                                break;
-                            }
-                        }
-                    }
-                    __lcd_new();
+        //RA4 and RA5 are connected to edge side sensors
+        for (detect_sample = 0; detect_sample < CLASS_SAMPLES; detect_sample++){
+            TASK_WAIT_MS(&detect_task, CLASS_PERIOD_MS);
+            ClassifyVote(CLASS_EDGE, (SensorsRaw() & (bottle_type_flag ? SENSOR_YOP_EDGE : SENSOR_ESKA_EDGE)) != 0);
+        }
+        StageEnd(STAGE_EDGE);
+        __lcd_new();
                     
-                    LATCbits.LC5 = 0; 
-                    LATCbits.LC6 = 1; //RC6 turns on post side sensor
-                    LATCbits.LC7 = 0;
-
-                    StepperMotorRotateDown1to2();
-                    MotorPos = 2;
-           		}
-                else if (no_bottle_time == 1){
-                    LATCbits.LC2 = 1;
-                    LATCbits.LC1 = 0;
-                    no_bottle_time += 1;
-                }
-
-           		else if (no_bottle_time == 5000){ 
-           			LATCbits.LC2 = 0;
-                    LATCbits.LC1 = 1;  
-                    no_bottle_time += 1;
-           		}
-                
-                else if (no_bottle_time == 8500){
-                    LATCbits.LC2 = 1;
-                    LATCbits.LC1 = 0;
-                    no_bottle_time += 1;
-                }
-                
-                else if (no_bottle_time == 13000){ 
-           			LATCbits.LC2 = 0;
-                    LATCbits.LC1 = 1;  
-                    no_bottle_time += 1;
-           		}
-                
-                else if (no_bottle_time == 15000){
-           			LATCbits.LC2 = 1;
-                    LATCbits.LC1 = 0;  
-                    no_bottle_time += 1;
-           		}
+        EDGE_SENSOR_PWR = 0; 
+        POST_SENSOR_PWR = 1; //RC6 turns on post side sensor
+        TOP_SENSOR_PWR = 0;
+
+        StageBegin(STAGE_TO_POST);
+        ProfileMark(PROF_TO_POST);
+        StepperMotorRotateDown1to2();
+        MotorPos = STEPPER_POST;
+    }
+    TASK_END(&detect_task);
+}
 
-                
-                else if (no_bottle_time >= 21000){ 
-                    SortDone();   
-           		}
-
-
-           		else {                    
-           			no_bottle_time +=1;
-           		}
-            }            
-            
-           
-
-            if (MotorPos == 2) {
-                //Move to 1 is Yop and Cap
-                //Move to 2 is Yop and No Cap
-                //Move to 3 is Eska and Cap
-                //Move to 4 is Eska and No Cap
+//STEPPER_POST: reads the post sensor, classifies the bottle and picks its bin
+void ClassifyTask(void){
+    TASK_BEGIN(&classify_task);
+    while(1){
+        TASK_WAIT_UNTIL(&classify_task, MotorPos == STEPPER_POST && !StepperBusy());
+        StageEnd(STAGE_TO_POST);
+        StageBegin(STAGE_POST);
+        ProfileMark(PROF_POST);
+        //Move to 1 is Yop and Cap
+        //Move to 2 is Yop and No Cap
+        //Move to 3 is Eska and Cap
+        //Move to 4 is Eska and No Cap
                                 
-
-                __delay_ms(500);
+        //Let the carriage settle after the move
+        TASK_WAIT_MS(&classify_task, 1000);
+        __lcd_new();
+        TASK_WAIT_MS(&classify_task, 500 - CLASS_SAMPLE_MS);
                 
-                //Detecting appropriate post sensor reading:
-                while(1){
-                    if (bottle_type_flag){
-                        post_side_sensor_flag = PORTDbits.RD0;
-                        __delay_ms(40);
-                        if (PORTDbits.RD0 == post_side_sensor_flag){
-                            break;
-                        }
-                    }
-                    else {
-                        post_side_sensor_flag = PORTDbits.RD1;
-                        __delay_ms(40);
-                        if (PORTDbits.RD1 == post_side_sensor_flag){
-                            break;
-                        }
-                    }
-                }
-
-                __lcd_new();
+        //Vote the post sensor, again if the bottle is still unclear
+        do {
+            for (classify_sample = 0; classify_sample < CLASS_SAMPLES; classify_sample++){
+                TASK_WAIT_MS(&classify_task, CLASS_PERIOD_MS);
+                ClassifyVote(CLASS_POST, (SensorsRaw() & (bottle_type_flag ? SENSOR_YOP_POST : SENSOR_ESKA_POST)) != 0);
+            }
+            ClassifyDecide();
+        } while (ClassifyResample());
+
+        StageEnd(STAGE_POST);
+        __lcd_new();
                 
-                bottle_count += 1;
+        bottle_count += 1;
                 
-                //Logic to determine cap or no cap:
-                if (bottle_type_flag){
-                    if (edge_side_sensor_flag && post_side_sensor_flag){
-                        printf("Yop Cap");
-                        move_to = 1;
-                        cap_yop_count += 1;
-                    }
-                    else{
-                        printf("Yop No Cap");
-                        move_to = 2;
-                        nocap_yop_count += 1;
-                    }
-                }
-                else {
-                    if (edge_side_sensor_flag || post_side_sensor_flag){
-                        printf("Eska Cap");
-                        move_to = 3;
-                        cap_eska_count += 1;
-                    }
-                    
-                    else {
-                        printf("Eska No Cap");
-                        move_to = 4;
-                        nocap_eska_count += 1;
-                    }
-                }
+        //The votes pick the bin, see classify_table.c
+        move_to = ClassifyBin();
+        if (move_to == BIN_YOP_CAP){
+            FmtStr("Yop Cap ");
+            cap_yop_count += 1;
+        }
+        else if (move_to == BIN_YOP_NOCAP){
+            FmtStr("Yop No Cap ");
+            nocap_yop_count += 1;
+        }
+        else if (move_to == BIN_ESKA_CAP){
+            FmtStr("Eska Cap ");
+            cap_eska_count += 1;
+        }
+        else {
+            FmtStr("Eska No Cap ");
+            nocap_eska_count += 1;
+        }
+        FmtDec(ClassifyConfidence(), 0);
+        FmtStr("%");
                 
-                StepperMotorRotateDown2to3();
-            	MotorPos = 3;
-            }
+        //The servo turns towards the bin while we move down
+        StageBegin(STAGE_SERVO);
+        BinServoSetTarget(move_to);
+        StageBegin(STAGE_TO_BOTTOM);
+        ProfileMark(PROF_TO_BOTTOM);
+        StepperMotorRotateDown2to3();
+        MotorPos = STEPPER_BOTTOM;
+    }
+    TASK_END(&classify_task);
+}
 
-            if (MotorPos == 3){
-                //Turn off all sensors:
-                LATCbits.LC5 = 0; 
-                LATCbits.LC6 = 0;
-                LATCbits.LC7 = 0;
-                
+//STEPPER_BOTTOM: tips the bottle into its bin and returns to the top
+void DropTask(void){
+    TASK_BEGIN(&drop_task);
+    while(1){
+        TASK_WAIT_UNTIL(&drop_task, MotorPos == STEPPER_BOTTOM && !StepperBusy());
+        StageEnd(STAGE_TO_BOTTOM);
+        ProfileMark(PROF_SERVO);
+        TASK_WAIT_UNTIL(&drop_task, BinServoSettled());
+        StageEnd(STAGE_SERVO);
+
+        //Turn off all sensors:
+        EDGE_SENSOR_PWR = 0; 
+        POST_SENSOR_PWR = 0;
+        TOP_SENSOR_PWR = 0;
                 
-                //Rotate up slowly first to allow for bottle to drop:
-            	StepperMotorRotateUpSlow();
-                StepperMotorRotateUpSlow();
-                for(int i = 0; i < 100; i++){
-                    BinMotorMoveTo(move_to);
-                }
+        //Rotate up slowly first to allow for bottle to drop. The servo keeps
+        //holding the bin until the next bottle is classified.
+        StageBegin(STAGE_TIP);
+        ProfileMark(PROF_TIP);
+        StepperMotorRotateUpSlow();
+        TASK_WAIT_UNTIL(&drop_task, !StepperBusy());
+        StageEnd(STAGE_TIP);
                 
-                StepperMotorRotateUpFast(); // Rotate back to initial position
-            	MotorPos = 1;
-            }
-           	  
-        }
-    
+        ProfileMark(PROF_RETURN);
+        StepperMotorRotateUpFast(); // Rotate back to initial position
+        MotorPos = STEPPER_TOP;
+    }
+    TASK_END(&drop_task);
+}
+
+//Agitates the feed while waiting for a bottle, see centrifuge.c, and ends
+//the run if none turns up
+void CentrifugeTask(void){
+    if (!waiting_for_bottle){
+        return;
+    }
+    no_bottle_time = SchedMillis() - no_bottle_start;
+
+    if (no_bottle_time >= NO_BOTTLE_LIMIT_MS){ 
+        SortDone();   
+    }
+    else {
+        AgitateUpdate(no_bottle_time);
     }
-    return;
 }
 
 void __lcd_new(void){
-    __lcd_home();
-    printf("                ");
-    __lcd_newline();
-    printf("                ");
-    __lcd_home();
+    LcdClear();
 }
 
+//The StepperMotorRotate functions only start a move, see stepper.c
 void StepperMotorRotateUpSlow(void){
-    LATCbits.LC2 = 0;
-    LATCbits.LC1 = 0;
+    CentrifugeStop();
     __lcd_new();
     
-    //Rotating Stepper up slowly, holding servo as well to ensure correct bottle drop:
-    for(int i = 0; i < 5; i++){
-        for(int j = 0; j < 8; j++){
-            LATA = CW[j];           
-            BinMotorMoveTo(move_to);
-        }
-        
-    }
+    //20 ms per half step, as when every step waited for a servo frame
+    StepperCreepTo(STEPPER_TIPPED, 20000);
 }
 
 void StepperMotorRotateUpFast(void){
-    LATCbits.LC5 = 0; 
-    LATCbits.LC6 = 0; 
-    LATCbits.LC7 = 1; //RC7 turns on top sensor
+    EDGE_SENSOR_PWR = 0; 
+    POST_SENSOR_PWR = 0; 
+    TOP_SENSOR_PWR = 1; //RC7 turns on top sensor
     
     //Turn off centrifuge:
-    LATCbits.LC2 = 0;
-    LATCbits.LC1 = 0;
-
+    CentrifugeStop();
 
     __lcd_new();
     
-    //Rotating motor upwards, checking for bottle detection as well
     bottle_existence_flag = 0;
-    __lcd_new();
-    int i = 0;
-    while (PORTBbits.RB0 != 0){
-        for(int j = 0; j < 8; j++){
-            __lcd_new();
-            LATA = CW[j];
-            __delay_us(2);
-            if(PORTEbits.RE0){
-                __lcd_new();
-                bottle_existence_flag = 1;
-            }
-        }
-        i++;
-        
-        //Failsafe if jam or motor fail:
-        if (i > 300){
-            emergency_flag = 1;
-            return;
-        }
+    SensorsRose(SENSOR_EXIST);
+    StageBegin(STAGE_RETURN);
+    StepperHome();
+}
+
+//Rotating motor upwards, checking for bottle detection as well
+bool CarriageHomed(void){
+    if(SensorsRose(SENSOR_EXIST)){
+        bottle_existence_flag = 1;
+    }
+    if (StepperBusy()){
+        return 0;
+    }
+    if (StepperFault()){
+        emergency_flag = 1;
     }
+    return 1;
 }
 
+void StepperMotorRotateDown1to2(void){
+    __lcd_new();
+    StepperMoveTo(STEPPER_POST);
+}
 
+void StepperMotorRotateDown2to3(void){
+    EDGE_SENSOR_PWR = 0; //RC5 turns on edge side sensor
+    POST_SENSOR_PWR = 0; //RC6 turns on post side sensor
+    TOP_SENSOR_PWR = 0;
+    StepperMoveTo(STEPPER_BOTTOM);
+}
 
 
-void StepperMotorRotateDown1to2(void){
-    __lcd_new();
-    for(int i = 0; i < 45; i++){ 
-        for(int j = 0; j < 8; j++){
-            LATA = CCW[j];
-            __delay_ms(1);
-        }
+
+//Sends the stored runs to the PC, ExportTask does the transfer
+void LogTask(void){
+    TASK_BEGIN(&log_task);
+    while(1){
+        TASK_WAIT_UNTIL(&log_task, log_sending);
+        TASK_WAIT_MS(&log_task, 1000);
+        __lcd_new();
+        FmtStr("TRANSFERRING...");
+        ExportStart();
+        TASK_WAIT_UNTIL(&log_task, ExportState() != EXPORT_RUNNING);
+        __lcd_new();
+        FmtStr(ExportState() == EXPORT_DONE ? "DONE" : "TRANSFER FAILED");
+        TASK_WAIT_MS(&log_task, 1000);
+        log_sending = 0;
+        UiGoto(STATE_MAIN_MENU);
     }
-    __delay_1s();
-    __lcd_new();
+    TASK_END(&log_task);
 }
 
-void StepperMotorRotateDown2to3(void){
-    LATCbits.LC5 = 0; //RC5 turns on edge side sensor
-    LATCbits.LC6 = 0; //RC6 turns on post side sensor
-    LATCbits.LC7 = 0;
-    for(int i = 0; i < 40; i++){ 
-        for(int j = 0; j < 8; j++){
-            LATA = CCW[j];
-            __delay_ms(2);
-        }
+//Live counters for the PC link, see link.h
+void RunStatus(unsigned char *buf){
+    unsigned long ms = (state == STATE_RUNNING) ? SchedMillis() - run_start : 0;
+
+    buf[0] = state;
+    buf[1] = state == STATE_RUNNING;
+    buf[2] = bottle_count;
+    buf[3] = cap_yop_count;
+    buf[4] = nocap_yop_count;
+    buf[5] = cap_eska_count;
+    buf[6] = nocap_eska_count;
+    for (unsigned char i = 7; i < 11; i++){
+        buf[i] = ms;
+        ms >>= 8;
     }
-    for(int i = 0; i < 40; i++){
-        BinMotorMoveTo(move_to);
-    } 
+    buf[11] = Sensors();
 }
-   
-void BinMotorMoveTo(char n){
-    switch(n){
+
+//Top line of the all-time statistics screen, pages 1 to 8
+void AllStatsPage(unsigned char page){
+    const journal_stats_t *st = JournalStats();
+
+    __lcd_home();
+    switch (page){
         case 1:
-            LATC0 = 1;
-            __delay_us(800);
-            LATC0 = 0;
-            __delay_us(19200);
+            FmtStr("ALL RUNS:");
+            FmtDec(st->runs, 0);
             break;
         case 2:
-            LATC0 = 1;
-            __delay_us(1450);
-            LATC0 = 0;
-            __delay_us(18550);
+            FmtStr("BOTTLES:");
+            FmtDec((unsigned long)st->cap_yop + st->nocap_yop + st->cap_eska + st->nocap_eska, 0);
             break;
         case 3:
-            LATC0 = 1;
-            __delay_us(1770);
-            LATC0 = 0;
-            __delay_us(18230);
+            FmtStr("YOP CAP:");
+            FmtDec(st->cap_yop, 0);
             break;
         case 4:
-            LATC0 = 1;
-            __delay_us(2400);
-            LATC0 = 0;
-            __delay_us(17600);
+            FmtStr("YOP NO CAP:");
+            FmtDec(st->nocap_yop, 0);
+            break;
+        case 5:
+            FmtStr("ESKA CAP:");
+            FmtDec(st->cap_eska, 0);
+            break;
+        case 6:
+            FmtStr("ESKA NO CAP:");
+            FmtDec(st->nocap_eska, 0);
+            break;
+        case 7:
+            FmtStr("MEAN TIME:");
+            if (st->runs){
+                unsigned long mean = st->run_ms / st->runs;
+                FmtDec(mean / 1000, 0);
+                putch('.');
+                FmtDec((mean / 100) % 10, 1);
+                FmtStr("s");
+            } else {
+                FmtStr("-");
+            }
+            break;
+        case 8:
+            FmtStr("BEST:");
+            FmtDec(st->best_rate / 10, 0);
+            putch('.');
+            FmtDec(st->best_rate % 10, 1);
+            FmtStr("/MIN");
             break;
     }
+    LcdClearEol();
 }
 
-
-
 void SortDone(void){
+    run_t r;
+    profile_t prof;
+
     //Turn off centrifuge:
-    LATCbits.LC2 = 0;
-    LATCbits.LC1 = 0;
+    CentrifugeStop();
     
-    LATA = 0x00; //Release Stepper
+    StepperRelease(); //Release Stepper
+    BinServoOff();
+    waiting_for_bottle = 0;
+
+    //Stop the sorting tasks, the next run starts them over from homing
+    MotorPos = STEPPER_UNHOMED;
+    detect_task.pc = 0;
+    classify_task.pc = 0;
+    drop_task.pc = 0;
     
     //Finding time elapsed:
-    I2C_Master_Start(); //Start condition
-    I2C_Master_Write(0b11010000); //7 bit RTC address + Write
-    I2C_Master_Write(0x00); //Set memory pointer to seconds
-    I2C_Master_Stop(); //Stop condition
-
-    I2C_Master_Start();
-    I2C_Master_Write(0b11010001); //7 bit RTC address + Read
-    for(unsigned char i=0;i<0x06;i++){
-        end_time[i] = I2C_Master_Read(1);
-    }
-    time[6] = I2C_Master_Read(0);  //Final Read without ack
-    I2C_Master_Stop();
+    run_time_ms = SchedMillis() - run_start;
     
-    int time_elapsed = 0;
-    int endmin = __bcd_to_num(end_time[1]);
-    int endsec = __bcd_to_num(end_time[0]);
-    int min = __bcd_to_num(time[1]);
-    int sec = __bcd_to_num(time[0]);
-    int time_elapsed = ((endmin - min))*60 + (endsec - sec);
-    if ((endmin - min) < 0){
-        time_elapsed += 3600;
+    //Storing the run, the EEPROM writes finish in the background:
+    for (unsigned char i = 0; i < 7; i++){
+        r.time[i] = time[i];
     }
-    
-    //Storing Data in EEPROM:
-    num_runs_stored += 1;
-    Eeprom_WriteByte(num_runs_stored*16, time[6]);
-    Eeprom_WriteByte(num_runs_stored*16+1, time[5]);
-    Eeprom_WriteByte(num_runs_stored*16+2, time[4]);
-    Eeprom_WriteByte(num_runs_stored*16+3, time[2]);
-    Eeprom_WriteByte(num_runs_stored*16+4, time[1]);
-    Eeprom_WriteByte(num_runs_stored*16+5, time[0]);
-    Eeprom_WriteByte(num_runs_stored*16+6, time_elapsed);  
-    Eeprom_WriteByte(num_runs_stored*16+7, cap_yop_count);
-    Eeprom_WriteByte(num_runs_stored*16+8, nocap_yop_count);
-    Eeprom_WriteByte(num_runs_stored*16+9, cap_eska_count);
-    Eeprom_WriteByte(num_runs_stored*16+10, nocap_eska_count);
-    Eeprom_WriteByte(num_runs_stored*16+11, bottle_count);
-    Eeprom_WriteByte(num_runs_stored*16+12, 255);
-    Eeprom_WriteByte(num_runs_stored*16+13, 255);
-    Eeprom_WriteByte(num_runs_stored*16+14, 255);
-    Eeprom_WriteByte(num_runs_stored*16+15, 255);
-    Eeprom_WriteByte(0x00, num_runs_stored);
-
-    //Displaying done screen:
+    r.run_ms = run_time_ms;
+    r.cap_yop = cap_yop_count;
+    r.nocap_yop = nocap_yop_count;
+    r.cap_eska = cap_eska_count;
+    r.nocap_eska = nocap_eska_count;
+    ProfileSummary(&prof);
+    JournalAppend(&r, &prof);
+
+    UiGoto(STATE_DONE);
+}
+
+
+//Keypad menus. Each screen is a state with optional entry and exit hooks,
+//and ui_table gives the action and next state for every state and key, so
+//a key press costs one table lookup. An empty entry ignores the key.
+//STATE_STOPPED is never entered from the keypad, so it doubles as "stay".
+#define UI_STAY STATE_STOPPED
+#define UI_STATES (STATE_ALL_STATS + 1)
+
+//Returns the state to go to, normally next from the table
+typedef unsigned char (*ui_action_fn)(unsigned char key, unsigned char next);
+
+typedef struct {
+    ui_action_fn action;
+    unsigned char next;
+} ui_transition_t;
+
+typedef struct {
+    void (*enter)(void);
+    void (*exit)(void);
+} ui_screen_t;
+
+//Digit on each key, 0xFF for the letters and symbols
+static const unsigned char key_digit[KEYPAD_KEYS] = {
+    1, 2, 3, 0xFF, 4, 5, 6, 0xFF, 7, 8, 9, 0xFF, 0xFF, 0, 0xFF, 0xFF
+};
+
+//Shows text for a second, KeyTask then returns to the main menu
+unsigned char UiMessage(const char *text){
+    LcdCursor(0);
     __lcd_new();
-    printf("DONE (TOOK %ds)", time_elapsed);
+    FmtStr(text);
+    message_shown = 1;
+    return UI_STAY;
+}
+
+void MainMenuDraw(void){
+    ClockNow(time);
+    __lcd_home();
+    FmtDate(time);
     __lcd_newline();
-    printf("A:VIEW B:HOME");
-    state = STATE_DONE;
+    FmtPadded("A:START B:LOGS", LCD_COLS);
 }
 
+void RunningEnter(void){
+    __lcd_new();
+    FmtStr("RUNNING...");
+    __lcd_newline();
+}
 
+void DoneEnter(void){
+    __lcd_new();
+    FmtStr("DONE (TOOK ");
+    FmtDec(run_time_ms / 1000, 0);
+    FmtStr("s)");
+    __lcd_newline();
+    FmtStr("A:VIEW B:HOME");
+}
 
+//Top line of the run statistics screen, pages 1 to 7
+void RunStatPage(unsigned char page){
+    __lcd_home();
+    switch (page){
+        case 1:
+            FmtStr("TOTAL BOTTLES:");
+            FmtDec(RUN_BOTTLES(&log_run), 0);
+            break;
+        case 2:
+            FmtStr("YOP CAP:");
+            FmtDec(log_run.cap_yop, 0);
+            break;
+        case 3:
+            FmtStr("YOP NO CAP:");
+            FmtDec(log_run.nocap_yop, 0);
+            break;
+        case 4:
+            FmtStr("ESKA CAP:");
+            FmtDec(log_run.cap_eska, 0);
+            break;
+        case 5:
+            FmtStr("ESKA NO CAP:");
+            FmtDec(log_run.nocap_eska, 0);
+            break;
+        case 6:
+            FmtStr("RUN TIME:");
+            FmtDec(log_run.run_ms / 1000, 0);
+            putch('.');
+            FmtDec((log_run.run_ms / 100) % 10, 1);
+            FmtStr("s");
+            break;
+        case 7:
+            FmtDate(log_run.time);
+            return;
+    }
+    LcdClearEol();
+}
 
+//Top line of the profile screen: minimum, mean and maximum of a phase
+void ProfilePage(unsigned char phase){
+    static const char names[PROF_PHASES][4] = {
+        "DET", "SNS", "DN1", "PST", "DN2", "SRV", "TIP", "RET"
+    };
+    const unsigned char *v[3] = { log_profile.min, log_profile.mean, log_profile.max };
 
-void interrupt keypressed(void) {
-    if(INT1IF){
-        unsigned char keypress = (PORTB & 0xF0) >> 4;
-        switch (state){
-            case STATE_MAIN_MENU:
-                if(keys[keypress] == keys[3]){
-                    //START RUN:
-
-                    //Ensure there is still room to store runs:
-                    if (num_runs_stored == 64){
-                        __lcd_new();
-                        printf("NO MEMORY");
-                        __delay_1s();
-                        break;
-                    }
-                
-                    //Read Current Time:
-                    I2C_Master_Start(); //Start condition
-                    I2C_Master_Write(0b11010000); //7 bit RTC address + Write
-                    I2C_Master_Write(0x00); //Set memory pointer to seconds
-                    I2C_Master_Stop(); //Stop condition
-
-                    I2C_Master_Start();
-                    I2C_Master_Write(0b11010001); //7 bit RTC address + Read
-                    for(unsigned char i=0;i<0x06;i++){
-                        time[i] = I2C_Master_Read(1);
-                    }
-                    time[6] = I2C_Master_Read(0);       //Final Read without ack
-                    I2C_Master_Stop();
-                    
-                    //Setting initial counts and flags:
-                    cap_eska_count = 0;
-					nocap_eska_count = 0;
-					cap_yop_count = 0;
-					nocap_yop_count = 0;
-                    no_bottle_time = 0;
-                    bottle_count = 0;
-                    emergency_flag = 0;
-                    move_to = 2;
-                    
-                    
-                    __lcd_new();
-				    printf("RUNNING...");
-                    __lcd_newline();
-                    
-                    StepperMotorRotateUpFast(); //Ensuring stepper in correct starting position
-                    
-				    state = STATE_RUNNING;
-                }
+    __lcd_home();
+    if (!log_profiled){
+        FmtStr("NO PROFILE");
+        LcdClearEol();
+        return;
+    }
+    FmtStr(names[phase]);
+    for (unsigned char i = 0; i < 3; i++){
+        unsigned char tenths = (v[i][phase] * 10U + PROF_PER_S / 2) / PROF_PER_S;
+        putch(i ? '/' : ' ');
+        FmtDec(tenths / 10, 1);
+        putch('.');
+        FmtDec(tenths % 10, 1);
+    }
+    putch('s');
+}
 
-                else if (keys[keypress] == keys[7]){
-                    //ENTER LOG SELECT MENU
-                    
-                    if (num_runs_stored == 0){
-                        state = STATE_NO_LOGS;
-                        __lcd_new();
-                        printf("NO RUNS YET");
-                        __lcd_newline();
-                        printf("A:HOME");
-                    } else {
-                        state = STATE_CHOOSE_LOG;
-                        run_selected = num_runs_stored;
-                        __lcd_new();
-                        time[6] = Eeprom_ReadByte(run_selected*16);
-                        time[5] = Eeprom_ReadByte(run_selected*16+1);
-                        time[4] = Eeprom_ReadByte(run_selected*16+2);
-                        time[2] = Eeprom_ReadByte(run_selected*16+3);
-                        time[1] = Eeprom_ReadByte(run_selected*16+4);
-                        time[0] = Eeprom_ReadByte(run_selected*16+5);
-                        if (time[5] > 9){
-                            printf("%02x%02x-%02x %02x:%02x:%02x", time[6],time[5],time[4],time[2],time[1],time[0]);
-                        } else {
-                            printf("%02x-%x-%02x %02x:%02x:%02x", time[6],time[5],time[4],time[2],time[1],time[0]);
-                        }
-                        __lcd_newline();
-                        printf("A:VU B:NXT C:HME");
-                    }
-                }
-                
-                else if (keys[keypress] == keys[12]){
-                    //ENTER PC INTERFACE
-                    
-                    __lcd_new();
-                    printf("CONNECT TO PC");
-                    __lcd_newline();
-                    printf("A:SEND B:BACK");     
-                    state = STATE_SEND_LOGS;
-                }
-
-                else if (keys[keypress] == keys[13]){
-                    //ENTER CLEAR LOGS MENU
-                    
-                    __lcd_new();
-                    printf("CLEAR ALL LOGS?");
-                    __lcd_newline();
-                    printf("A:CLEAR B:BACK");     
-                    state = STATE_CLEAR_LOGS;
-                }
-                
-                else if (keys[keypress] == keys[14]){
-                    //ENTER SET DATE AND TIME MENU
-                    
-                    lcdInst(0b00001111);
-                    __lcd_new();
-                    set_time_cursor = 0;
-                    printf("SETTIME C:CANCEL");
-                    __lcd_newline();
-                    printf("  -  -     :  ");  
-                    __lcd_home();
-                    __lcd_newline();
-                    state = STATE_SET_TIME;
-                }
-                break; 
-
-            case STATE_DONE:
-                if((keys[keypress]) == keys[3]){
-                	run_selected = num_runs_stored;
-                    state = STATE_VIEW_LOG;
-                    stat_selected = 1;
-                    __lcd_new();
-                    printf("TOTAL BOTTLES:%d", Eeprom_ReadByte(run_selected*16+11));
-	                __lcd_newline();
-	                printf("A:NXTSTAT B:HOME");
-                }
-
-                if((keys[keypress]) == keys[7]){
-                	state = STATE_MAIN_MENU;
-                }
-                break;
-
-            case STATE_CHOOSE_LOG:
-                if((keys[keypress]) == keys[3]){
-                    //ENTER VIEWING SPECIFIC LOG MENU
-                    
-                    state = STATE_VIEW_LOG;
-                    stat_selected = 1;
-                    __lcd_new();
-                    printf("TOTAL BOTTLES:%d", Eeprom_ReadByte(run_selected*16+11));
-	                __lcd_newline();
-	                printf("A:NXTSTAT B:HOME");
-                }
-
-                if((keys[keypress]) == keys[7]){
-                    //CYCLE BETWEEN STORED LOGS
-                    
-                    __lcd_home();
-                	if (run_selected == 1){
-                		run_selected = num_runs_stored;
-                	}
-                	else {
-                		run_selected -= 1;
-                	}
-                    time[6] = Eeprom_ReadByte(run_selected*16);
-                    time[5] = Eeprom_ReadByte(run_selected*16+1);
-                    time[4] = Eeprom_ReadByte(run_selected*16+2);
-                    time[2] = Eeprom_ReadByte(run_selected*16+3);
-                    time[1] = Eeprom_ReadByte(run_selected*16+4);
-                    time[0] = Eeprom_ReadByte(run_selected*16+5);
-                    if (time[5] > 9){
-                        printf("%02x%02x-%02x %02x:%02x:%02x", time[6],time[5],time[4],time[2],time[1],time[0]);
-                    } else {
-                        printf("%02x-%x-%02x %02x:%02x:%02x", time[6],time[5],time[4],time[2],time[1],time[0]);
-                    }
-
-                }
-
-                if ((keys[keypress]) == keys[11]){
-                	state = STATE_MAIN_MENU;
-                }
-                break;
-
-            case STATE_VIEW_LOG:
-            	if((keys[keypress]) == keys[3]){
-                    //CYCLE BETWEEN STATISTICS ABOUT SELECTED LOG
-                    
-            		__lcd_home();
-
-                    if (stat_selected == 7){
-                    	stat_selected = 1;
-                    }
-                    else {
-                    	stat_selected += 1;
-                    }
-
-                    switch (stat_selected){
-                        case 1:
-                            printf("TOTAL BOTTLES:%d     ", Eeprom_ReadByte(run_selected*16+11));
-	                		break;
-	                	case 2:
-	                		printf("YOP CAP:%d          ", Eeprom_ReadByte(run_selected*16+7));
-	                		break;
-	                	case 3:
-	                		printf("YOP NO CAP:%d      ", Eeprom_ReadByte(run_selected*16+8));
-	                		break;
-	                	case 4:
-	                		printf("ESKA CAP:%d      ", Eeprom_ReadByte(run_selected*16+9));
-	                		break;
-	                	case 5:
-	                		printf("ESKA NO CAP:%d     ", Eeprom_ReadByte(run_selected*16+10));
-	                		break;
-	                	case 6:
-	                		printf("RUN TIME:%ds      ", Eeprom_ReadByte(run_selected*16+6));
-	                		break;
-	                	case 7:
-                            if (time[5] > 9){
-                                printf("%02x%02x-%02x %02x:%02x:%02x", time[6],time[5],time[4],time[2],time[1],time[0]);
-                            } else {
-                                printf("%02x-%x-%02x %02x:%02x:%02x", time[6],time[5],time[4],time[2],time[1],time[0]);
-                            }
-	                		break;
-                	}
-
-                }
-
-                if((keys[keypress]) == keys[7]){
-                	state = STATE_MAIN_MENU;
-                }
-                break;
-                
-            case STATE_NO_LOGS:
-                if((keys[keypress]) == keys[3]){
-            		state = STATE_MAIN_MENU;
-                }
-                break;
-            
-            case STATE_CLEAR_LOGS:
-                if((keys[keypress]) == keys[3]){
-                    num_runs_stored = 0;
-                    Eeprom_WriteByte(0x00, num_runs_stored);
-                    __lcd_new();
-                    printf("ALL LOGS CLEARED");
-                    __delay_1s();
-                    state = STATE_MAIN_MENU;
-                }
-                else{
-                    state = STATE_MAIN_MENU;
-                }
-                break;
-                
-            case STATE_SEND_LOGS:       
-                if((keys[keypress]) == keys[3]){
-                    
-                    __lcd_new();
-                    printf("PREPARING...");
-                    
-                    __delay_1s();
-                    
-                    __lcd_new();
-                    printf("TRANSFERRING...");
-                    int temp;
-                    for (int i = 16; i < (num_runs_stored + 1)*16; i++){
-                        if ((i % 16) < 6){
-                            //First six statistics are stored as BCD so convert:
-                            temp = __bcd_to_num(Eeprom_ReadByte(i));
-                        } else {
-                            temp = Eeprom_ReadByte(i);
-                        }
-                        I2C_Master_Start(); //Start condition
-                        I2C_Master_Write(0b00010000); //7 bit RTC address + Write
-                        I2C_Master_Write(temp); //7 bit RTC address + Write
-                        I2C_Master_Stop();
-                        __delay_ms(15);
-                    }
-                    I2C_Master_Start(); //Start condition
-                    I2C_Master_Write(0b00010000); //7 bit RTC address + Write
-                    I2C_Master_Write(250); //7 bit RTC address + Write
-                    I2C_Master_Stop();
-                    __delay_ms(15);
-
-                    __lcd_new();
-                    printf("DONE");
-                    __delay_1s();
-                    
-                    state = STATE_MAIN_MENU;
-                }
-                else{
-                    state = STATE_MAIN_MENU;
-                }
-                break;
-                
-            case STATE_SET_TIME:                
-                if((keys[keypress]) == keys[0]){
-                    set_time_cursor += 1;
-                    num_entered = 1;
-                }
-                else if((keys[keypress]) == keys[1]){
-                    set_time_cursor += 1;
-                    num_entered = 2;
-                }
-                else if((keys[keypress]) == keys[2]){
-                    set_time_cursor += 1;
-                    num_entered = 3;
-                }
-                else if((keys[keypress]) == keys[4]){
-                    set_time_cursor += 1;
-                    num_entered = 4;
-                }                
-                else if((keys[keypress]) == keys[5]){
-                    set_time_cursor += 1;
-                    num_entered = 5;
-                }                
-                else if((keys[keypress]) == keys[6]){
-                    set_time_cursor += 1;
-                    num_entered = 6;
-                }
-                else if ((keys[keypress]) == keys[7]){
-                    if ((set_time_cursor == 2)||(set_time_cursor == 4)||(set_time_cursor == 6)||(set_time_cursor == 8)||(set_time_cursor == 10)){
-                        __lcd_cursor_back();
-                    }
-                    if (set_time_cursor != 0){
-                        set_time_cursor -=1;
-                        __lcd_cursor_back();
-                    }
-                }
-                else if((keys[keypress]) == keys[8]){
-                    set_time_cursor += 1;
-                    num_entered = 7;
-                }
-                else if((keys[keypress]) == keys[9]){
-                    set_time_cursor += 1;
-                    num_entered = 8;
-                }
-                else if((keys[keypress]) == keys[10]){
-                    set_time_cursor += 1;
-                    num_entered = 9;
-                }  
-                
-                else if((keys[keypress]) == keys[11]){
-                    lcdInst(0b00001100);
-                    state = STATE_MAIN_MENU;
-                }  
-
-                else if((keys[keypress]) == keys[13]){
-                    set_time_cursor += 1;
-                    num_entered = 0;
-                }
-                
-                if (((keys[keypress]) != keys[7]) && ((keys[keypress]) != keys[3]) && ((keys[keypress]) != keys[12]) && ((keys[keypress]) != keys[14]) && ((keys[keypress]) != keys[15])){
-                    set_time[set_time_cursor] = num_entered;
-                    printf("%x", num_entered);
-                    if ((set_time_cursor == 2)||(set_time_cursor == 4)||(set_time_cursor == 6)||(set_time_cursor == 8)||(set_time_cursor == 10)){
-                        __lcd_cursor_next();
-                    }
-                }
-                
-                if (set_time_cursor == 10){
-                    
-                    //Taking care of invalid date and time entries:
-                    if ((set_time[9] > 5)||(set_time[7] > 2)||(set_time[5] > 3)||(set_time[3] > 1)||
-                        ((set_time[7] == 2) && (set_time[8] > 3))||((set_time[5] == 3) && (set_time[6] > 1))||
-                        ((set_time[3] == 1) && (set_time[4] > 2))||((set_time[3] == 0) && (set_time[4] == 0))||
-                        ((set_time[5] == 0) && (set_time[6] == 0))){
-                        lcdInst(0b00001100);
-                        __lcd_new();
-                        printf("NOT VALID");
-                        __delay_1s();
-                        state = STATE_MAIN_MENU;
-                    }
-                    
-                    else if (((set_time[4] == 4)||(set_time[4] == 6)||(set_time[4] == 9)||((set_time[3] == 1) && set_time[4] == 1)) && ((set_time[5]*10 + set_time[6]) > 30)){
-                        lcdInst(0b00001100);
-                        __lcd_new();
-                        printf("NOT VALID");
-                        __delay_1s();
-                        state = STATE_MAIN_MENU;
-                    }
-                    
-                    else if ((set_time[3] == 0) && (set_time[4] == 2) && ((set_time[5] * 10 + set_time[6]) > 29)){
-                        lcdInst(0b00001100);
-                        __lcd_new();
-                        printf("NOT VALID");
-                        __delay_1s();
-                        state = STATE_MAIN_MENU;
-                    } 
-                    
-                    else if ((set_time[3] == 0) && (set_time[4] == 2) && ((set_time[5] * 10 + set_time[6]) > 28) && ((set_time[1]*10+set_time[2])% 4 != 0)){
-                         lcdInst(0b00001100);
-                        __lcd_new();
-                        printf("NOT VALID");
-                        __delay_1s();
-                        state = STATE_MAIN_MENU;
-                    }
-                    else {
-                        time[0] = 0x00; //45 Seconds 
-                        time[1] = set_time[9]*16 + set_time[10]; //59 Minutes
-                        time[2] = set_time[7]*16 + set_time[8]; //24 hour STATE, set to 23:00
-                        time[3] = 0x07;
-                        time[4] = set_time[5]*16 + set_time[6]; //31st
-                        time[5] = set_time[3]*16 + set_time[4]; //December
-                        time[6] = set_time[1]*16 + set_time[2];//2016
-                        I2C_Master_Start(); //Start condition
-                        I2C_Master_Write(0b11010000); //7 bit RTC address + Write
-                        I2C_Master_Write(0x00); //Set memory pointer to seconds
-                        for(char i=0; i<7; i++){
-                            I2C_Master_Write(time[i]);
-                        }    
-                        I2C_Master_Stop(); //Stop condition
-                        lcdInst(0b00001100);
-                        state = STATE_MAIN_MENU;
-                    }
-                }
-                break;
+void ViewLogEnter(void){
+    stat_selected = 1;
+    prof_selected = PROF_PHASES - 1;
+    log_profiled = JournalProfile(run_selected, &log_profile);
+    __lcd_new();
+    __lcd_newline();
+    FmtStr("A:NXT B:HM C:PRF");
+    RunStatPage(stat_selected);
+}
+
+void ChooseLogEnter(void){
+    run_selected = JournalCount();
+    JournalRead(run_selected, &log_run);
+    __lcd_new();
+    FmtDate(log_run.time);
+    __lcd_newline();
+    FmtStr("A:VU B:NXT C:HME");
+}
+
+void NoLogsEnter(void){
+    __lcd_new();
+    FmtStr("NO RUNS YET");
+    __lcd_newline();
+    FmtStr("A:HOME");
+}
+
+void ClearLogsEnter(void){
+    __lcd_new();
+    FmtStr("CLEAR ALL LOGS?");
+    __lcd_newline();
+    FmtStr("A:CLEAR B:BACK");
+}
+
+void SendLogsEnter(void){
+    __lcd_new();
+    FmtStr("CONNECT TO PC");
+    __lcd_newline();
+    FmtStr("A:SEND B:BACK");
+}
+
+void SetTimeEnter(void){
+    LcdCursor(1);
+    __lcd_new();
+    set_time_cursor = 0;
+    FmtStr("SETTIME C:CANCEL");
+    __lcd_newline();
+    FmtStr("  -  -     :  ");
+    __lcd_home();
+    __lcd_newline();
+}
+
+void SetTimeExit(void){
+    LcdCursor(0);
+}
+
+void AllStatsEnter(void){
+    stat_selected = 1;
+    __lcd_new();
+    __lcd_newline();
+    FmtStr("A:NXTSTAT B:HOME");
+    AllStatsPage(stat_selected);
+}
+
+static const ui_screen_t ui_screens[UI_STATES] = {
+    [STATE_MAIN_MENU]   = { MainMenuDraw, 0 },
+    [STATE_RUNNING]     = { RunningEnter, 0 },
+    [STATE_DONE]        = { DoneEnter, 0 },
+    [STATE_VIEW_LOG]    = { ViewLogEnter, 0 },
+    [STATE_CHOOSE_LOG]  = { ChooseLogEnter, 0 },
+    [STATE_NO_LOGS]     = { NoLogsEnter, 0 },
+    [STATE_CLEAR_LOGS]  = { ClearLogsEnter, 0 },
+    [STATE_SEND_LOGS]   = { SendLogsEnter, 0 },
+    [STATE_SET_TIME]    = { SetTimeEnter, SetTimeExit },
+    [STATE_ALL_STATS]   = { AllStatsEnter, 0 },
+};
+
+unsigned char StartRun(unsigned char key, unsigned char next){
+    ClockNow(time);
+    run_start = SchedMillis();
+
+    cap_eska_count = 0;
+    nocap_eska_count = 0;
+    cap_yop_count = 0;
+    nocap_yop_count = 0;
+    no_bottle_time = 0;
+    bottle_count = 0;
+    emergency_flag = 0;
+    move_to = 2;
+
+    //DetectTask homes the stepper before looking for bottles
+    return next;
+}
+
+unsigned char OpenLogs(unsigned char key, unsigned char next){
+    return JournalCount() ? next : STATE_NO_LOGS;
+}
+
+unsigned char ViewLatest(unsigned char key, unsigned char next){
+    run_selected = JournalCount();
+    JournalRead(run_selected, &log_run);
+    return next;
+}
+
+unsigned char NextRunStat(unsigned char key, unsigned char next){
+    stat_selected = (stat_selected == 7) ? 1 : stat_selected + 1;
+    RunStatPage(stat_selected);
+    return next;
+}
+
+//Steps through the phases of the run's profile
+unsigned char NextProfile(unsigned char key, unsigned char next){
+    prof_selected = (prof_selected + 1) % PROF_PHASES;
+    ProfilePage(prof_selected);
+    return next;
+}
+
+unsigned char NextAllStat(unsigned char key, unsigned char next){
+    stat_selected = (stat_selected == 8) ? 1 : stat_selected + 1;
+    AllStatsPage(stat_selected);
+    return next;
+}
+
+//Steps back through the stored runs, from the newest
+unsigned char PrevRun(unsigned char key, unsigned char next){
+    run_selected = (run_selected == 1) ? JournalCount() : run_selected - 1;
+    JournalRead(run_selected, &log_run);
+    __lcd_home();
+    FmtDate(log_run.time);
+    return next;
+}
+
+unsigned char ClearLogs(unsigned char key, unsigned char next){
+    JournalClear();
+    return UiMessage("ALL LOGS CLEARED");
+}
+
+unsigned char SendLogs(unsigned char key, unsigned char next){
+    if (!log_sending){
+        __lcd_new();
+        FmtStr("PREPARING...");
+        log_sending = 1;
+    }
+    return next;
+}
+
+//LogTask returns to the main menu once the transfer is over
+unsigned char LeaveSendLogs(unsigned char key, unsigned char next){
+    return log_sending ? UI_STAY : next;
+}
+
+bool DateValid(void){
+    unsigned char month = set_time[3] * 10 + set_time[4];
+    unsigned char day = set_time[5] * 10 + set_time[6];
+
+    if (set_time[9] > 5 || set_time[7] * 10 + set_time[8] > 23 || month == 0 || month > 12 || day == 0 || day > 31){
+        return false;
+    }
+    if ((month == 4 || month == 6 || month == 9 || month == 11) && day > 30){
+        return false;
+    }
+    if (month == 2 && day > ((set_time[1] * 10 + set_time[2]) % 4 ? 28 : 29)){
+        return false;
+    }
+    return true;
+}
+
+//Digits fill in YY-MM-DD HH:MM, set_time[1] to set_time[10]
+unsigned char SetTimeDigit(unsigned char key, unsigned char next){
+    set_time_cursor += 1;
+    set_time[set_time_cursor] = key_digit[key];
+    FmtDec(key_digit[key], 1);
+    if (set_time_cursor == 2 || set_time_cursor == 4 || set_time_cursor == 6 || set_time_cursor == 8 || set_time_cursor == 10){
+        __lcd_cursor_next();
+    }
+    if (set_time_cursor < 10){
+        return next;
+    }
+    if (!DateValid()){
+        return UiMessage("NOT VALID");
+    }
+    time[0] = 0x00;
+    time[1] = set_time[9]*16 + set_time[10];
+    time[2] = set_time[7]*16 + set_time[8];
+    time[3] = 0x07;
+    time[4] = set_time[5]*16 + set_time[6];
+    time[5] = set_time[3]*16 + set_time[4];
+    time[6] = set_time[1]*16 + set_time[2];
+    ClockSet(time);
+    return STATE_MAIN_MENU;
+}
+
+unsigned char SetTimeBack(unsigned char key, unsigned char next){
+    if (set_time_cursor == 2 || set_time_cursor == 4 || set_time_cursor == 6 || set_time_cursor == 8 || set_time_cursor == 10){
+        __lcd_cursor_back();
+    }
+    if (set_time_cursor != 0){
+        set_time_cursor -= 1;
+        __lcd_cursor_back();
+    }
+    return next;
+}
+
+#define HOME            { 0, STATE_MAIN_MENU }
+#define DIGIT           { SetTimeDigit, UI_STAY }
+#define LEAVE_SEND      { LeaveSendLogs, STATE_MAIN_MENU }
+
+static const ui_transition_t ui_table[UI_STATES][KEYPAD_KEYS] = {
+    [STATE_MAIN_MENU] = {
+        [KEY_A]     = { StartRun, STATE_RUNNING },
+        [KEY_B]     = { OpenLogs, STATE_CHOOSE_LOG },
+        [KEY_C]     = { 0, STATE_ALL_STATS },
+        [KEY_STAR]  = { 0, STATE_SEND_LOGS },
+        [KEY_0]     = { 0, STATE_CLEAR_LOGS },
+        [KEY_HASH]  = { 0, STATE_SET_TIME },
+    },
+    [STATE_DONE] = {
+        [KEY_A]     = { ViewLatest, STATE_VIEW_LOG },
+        [KEY_B]     = HOME,
+    },
+    [STATE_VIEW_LOG] = {
+        [KEY_A]     = { NextRunStat, UI_STAY },
+        [KEY_B]     = HOME,
+        [KEY_C]     = { NextProfile, UI_STAY },
+    },
+    [STATE_CHOOSE_LOG] = {
+        [KEY_A]     = { 0, STATE_VIEW_LOG },
+        [KEY_B]     = { PrevRun, UI_STAY },
+        [KEY_C]     = HOME,
+    },
+    [STATE_NO_LOGS] = {
+        [KEY_A]     = HOME,
+    },
+    [STATE_CLEAR_LOGS] = {
+        HOME, HOME, HOME, { ClearLogs, UI_STAY },
+        HOME, HOME, HOME, HOME,
+        HOME, HOME, HOME, HOME,
+        HOME, HOME, HOME, HOME,
+    },
+    [STATE_SEND_LOGS] = {
+        LEAVE_SEND, LEAVE_SEND, LEAVE_SEND, { SendLogs, UI_STAY },
+        LEAVE_SEND, LEAVE_SEND, LEAVE_SEND, LEAVE_SEND,
+        LEAVE_SEND, LEAVE_SEND, LEAVE_SEND, LEAVE_SEND,
+        LEAVE_SEND, LEAVE_SEND, LEAVE_SEND, LEAVE_SEND,
+    },
+    [STATE_SET_TIME] = {
+        DIGIT, DIGIT, DIGIT, { 0, UI_STAY },
+        DIGIT, DIGIT, DIGIT, { SetTimeBack, UI_STAY },
+        DIGIT, DIGIT, DIGIT, HOME,
+        { 0, UI_STAY }, DIGIT, { 0, UI_STAY }, { 0, UI_STAY },
+    },
+    [STATE_ALL_STATS] = {
+        [KEY_A]     = { NextAllStat, UI_STAY },
+        [KEY_B]     = HOME,
+    },
+};
+
+//! @brief      Leaves the current screen for another.
+void UiGoto(unsigned char next){
+    if (ui_screens[state].exit){
+        ui_screens[state].exit();
+    }
+    state = next;
+    if (ui_screens[state].enter){
+        ui_screens[state].enter();
+    }
+}
+
+//! @brief      Runs the table entry for a key on the current screen.
+//! @param      key the encoder code, see keypad.h
+void UiKey(unsigned char key){
+    const ui_transition_t *t = &ui_table[state][key];
+    unsigned char next = t->next;
+
+    if (t->action){
+        next = t->action(key, next);
+    }
+    if (next != UI_STAY){
+        UiGoto(next);
+    }
+}
+
+//Takes key presses from the keypad queue, away from the interrupt
+void KeyTask(void){
+    unsigned char key;
+
+    TASK_BEGIN(&key_task);
+    while(1){
+        TASK_WAIT_UNTIL(&key_task, KeypadGet(&key));
+        UiKey(key);
+        if (message_shown){
+            TASK_WAIT_MS(&key_task, 1000);
+            message_shown = 0;
+            UiGoto(STATE_MAIN_MENU);
         }
+    }
+    TASK_END(&key_task);
+}
 
-        INT1IF = 0;     //Clear flag bit
+void interrupt keypressed(void) {
+    if(TMR3IE && TMR3IF){
+        TMR3IF = 0;
+        BinServoISR();
+    }
+    if(INT0IE && INT0IF){
+        StepperSwitchISR();     //Before the timer can take another step
+    }
+    if(TMR1IE && TMR1IF){
+        TMR1IF = 0;
+        StepperISR();
+    }
+    if(SSPIF || BCLIF){
+        I2C_ISR();
+    }
+    if(PIR1bits.RCIF || (PIE1bits.TXIE && PIR1bits.TXIF)){
+        UartISR();
+    }
+    if(EEIE && EEIF){
+        Eeprom_ISR();
+    }
+    if(TMR0IF){
+        SchedTick();
+        SensorsSample();
+        CentrifugeTick();
+        I2C_Tick();
+        TMR0IF = 0;
+    }
+    if(INT2IE && INT2IF){
+        INT2IF = 0;
+        ClockTick();
+    }
+    if(INT1IF){
+        KeypadISR();
     }
 }
 
@@ -0,0 +1,84 @@
+/*
+ * File:   profile.c
+ */
+
+#include <xc.h>
+#include "scheduler.h"
+#include "profile.h"
+
+//Phase durations of every bottle in the current run. The phases follow
+//each other, so one start time covers them all.
+static unsigned char bottle[PROFILE_BOTTLES][PROF_PHASES];
+static unsigned long total_ms[PROF_PHASES];
+static unsigned char bottles;
+static unsigned char phase;
+static unsigned long phase_start;
+
+static unsigned char Fixed(unsigned long ms){
+    unsigned long v = (ms * PROF_PER_S + 500) / 1000;
+    return v < PROF_MAX ? v : PROF_MAX;
+}
+
+//! @brief      Starts a new run with no bottles.
+void ProfileReset(void){
+    for (unsigned char i = 0; i < PROF_PHASES; i++){
+        total_ms[i] = 0;
+    }
+    bottles = 0;
+    phase = PROF_NONE;
+}
+
+//! @brief      Ends the current phase of the bottle and starts the next.
+void ProfileMark(unsigned char next){
+    unsigned long now = SchedMillis();
+
+    if (phase != PROF_NONE){
+        total_ms[phase] += now - phase_start;
+        if (bottles < PROFILE_BOTTLES){
+            bottle[bottles][phase] = Fixed(now - phase_start);
+        }
+    }
+    phase = next;
+    phase_start = now;
+}
+
+//! @brief      Ends the return to the top, which completes the bottle.
+//!             Does nothing before the first bottle of a run.
+void ProfileBottleDone(void){
+    if (phase != PROF_RETURN){
+        return;
+    }
+    ProfileMark(PROF_NONE);
+    bottles++;
+}
+
+//! @returns    Bottles completed in the current run.
+unsigned char ProfileBottles(void){
+    return bottles;
+}
+
+//! @returns    Phase durations of bottle n of the current run, from 0.
+//!             Only the first PROFILE_BOTTLES are kept.
+const unsigned char *ProfileBottle(unsigned char n){
+    return bottle[n < PROFILE_BOTTLES ? n : PROFILE_BOTTLES - 1];
+}
+
+//! @brief      Sums the current run up as the minimum, mean and maximum
+//!             of each phase. All zero if no bottle was completed.
+void ProfileSummary(profile_t *p){
+    unsigned char kept = bottles < PROFILE_BOTTLES ? bottles : PROFILE_BOTTLES;
+
+    for (unsigned char i = 0; i < PROF_PHASES; i++){
+        p->min[i] = kept ? PROF_MAX : 0;
+        p->max[i] = 0;
+        for (unsigned char b = 0; b < kept; b++){
+            if (bottle[b][i] < p->min[i]){
+                p->min[i] = bottle[b][i];
+            }
+            if (bottle[b][i] > p->max[i]){
+                p->max[i] = bottle[b][i];
+            }
+        }
+        p->mean[i] = bottles ? Fixed(total_ms[i] / bottles) : 0;
+    }
+}
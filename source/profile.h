@@ -0,0 +1,42 @@
+/*
+ * File:   profile.h
+ */
+
+#ifndef PROFILE_H
+#define	PROFILE_H
+
+//Phases of one bottle's trip round the carriage cycle (MotorPos 1, 2, 3
+//and back to 1). Unlike the stages in stages.h they never overlap.
+#define PROF_DETECT         0   //carriage home until a bottle is seen
+#define PROF_SENSE          1   //type and edge sensors at the top
+#define PROF_TO_POST        2   //move 1 to 2
+#define PROF_POST           3   //settle and read the post sensor
+#define PROF_TO_BOTTOM      4   //move 2 to 3
+#define PROF_SERVO          5   //at the bottom until the servo has settled
+#define PROF_TIP            6   //slow rise that lets the bottle go
+#define PROF_RETURN         7   //back up to the home switch
+#define PROF_PHASES         8
+#define PROF_NONE           0xFF
+
+#define PROFILE_BOTTLES     16  //Bottles per run kept in RAM
+
+//Durations are unsigned 3.5 fixed point seconds: 1/32 s steps up to 7.97 s,
+//longer ones are stored as PROF_MAX
+#define PROF_PER_S          32
+#define PROF_MAX            255
+
+//Phase durations over one run, the profile kept with each run record
+typedef struct {
+    unsigned char min[PROF_PHASES];
+    unsigned char mean[PROF_PHASES];
+    unsigned char max[PROF_PHASES];
+} profile_t;
+
+void ProfileReset(void);
+void ProfileMark(unsigned char phase);
+void ProfileBottleDone(void);
+unsigned char ProfileBottles(void);
+const unsigned char *ProfileBottle(unsigned char n);
+void ProfileSummary(profile_t *p);
+
+#endif	/* PROFILE_H */
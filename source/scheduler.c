@@ -0,0 +1,61 @@
+/*
+ * File:   scheduler.c
+ */
+
+#include <xc.h>
+#include "configBits.h"
+#include "scheduler.h"
+
+#define TMR0_RELOAD     (65536 - 1000)  //1 ms at Fosc/4 with a 1:8 prescaler
+
+volatile unsigned long sched_ticks;
+
+static task_fn tasks[SCHED_MAX_TASKS];
+static unsigned char num_tasks;
+
+void SchedInit(void){
+    num_tasks = 0;
+    sched_ticks = 0;
+
+    T0CON = 0b00000010;     //16 bit, internal clock, prescaler 1:8
+    TMR0H = TMR0_RELOAD >> 8;
+    TMR0L = TMR0_RELOAD & 0xFF;
+    TMR0IF = 0;
+    TMR0IE = 1;
+    T0CONbits.TMR0ON = 1;
+}
+
+void SchedAdd(task_fn fn){
+    if (num_tasks < SCHED_MAX_TASKS){
+        tasks[num_tasks++] = fn;
+    }
+}
+
+void SchedRun(void){
+    for (unsigned char i = 0; i < num_tasks; i++){
+        tasks[i]();
+    }
+}
+
+//! @brief      Advances the tick, called from the ISR on TMR0IF.
+void SchedTick(void){
+    TMR0H = TMR0_RELOAD >> 8;
+    TMR0L = TMR0_RELOAD & 0xFF;
+    sched_ticks++;
+}
+
+//! @brief      Reads the millisecond tick.
+//! @returns    Ticks since SchedInit(), read consistently even if the ISR
+//!             updates it halfway through. Wraps after 49 days.
+unsigned long SchedMillis(void){
+    unsigned long t;
+    do {
+        t = sched_ticks;
+    } while (t != sched_ticks);
+    return t;
+}
+
+//! @returns    Low 16 bits of the tick, enough for intervals under 32 s.
+unsigned int SchedTicks(void){
+    return (unsigned int)SchedMillis();
+}
@@ -0,0 +1,39 @@
+/*
+ * File:   scheduler.h
+ */
+
+#ifndef SCHEDULER_H
+#define	SCHEDULER_H
+
+#define SCHED_MAX_TASKS     10
+
+typedef void (*task_fn)(void);
+
+//Resume point and wake-up tick of one task
+typedef struct {
+    unsigned int pc;
+    unsigned int wake;
+} task_t;
+
+extern volatile unsigned long sched_ticks;
+
+void SchedInit(void);
+void SchedAdd(task_fn fn);
+void SchedRun(void);
+void SchedTick(void);
+unsigned long SchedMillis(void);
+unsigned int SchedTicks(void);
+
+//Tasks are plain functions called on every pass of the main loop. These
+//macros let a task be written as straight-line code: a wait saves the
+//line it stopped at and returns, and the next call resumes there.
+//Locals do not survive a wait, so tasks keep their state in globals, and
+//a task may not use a switch statement across a wait.
+#define TASK_BEGIN(t)           switch ((t)->pc) { case 0:
+#define TASK_END(t)             } (t)->pc = 0
+#define TASK_WAIT_UNTIL(t, c)   (t)->pc = __LINE__; case __LINE__: if (!(c)) return
+#define TASK_WAIT_MS(t, ms)     (t)->wake = SchedTicks() + (ms); \
+                                TASK_WAIT_UNTIL(t, (int)(SchedTicks() - (t)->wake) >= 0)
+#define TASK_RESTART(t)         (t)->pc = 0; return
+
+#endif	/* SCHEDULER_H */
@@ -0,0 +1,89 @@
+/*
+ * File:   sensors.c
+ */
+
+#include <xc.h>
+#include "configBits.h"
+#include "constants.h"
+#include "sensors.h"
+
+static volatile unsigned char stable;   //debounced snapshot
+static volatile unsigned char rose;     //bits that went to 1 since last asked
+static volatile unsigned char last;     //undebounced, for the classifier's votes
+static unsigned char level[NUM_SENSORS];
+
+void SensorsInit(void){
+    stable = 0;
+    rose = 0;
+    last = 0;
+    for (unsigned char i = 0; i < NUM_SENSORS; i++){
+        level[i] = 0;
+    }
+}
+
+//! @brief      Samples all bottle sensors at once and integrates each of
+//!             them, called from the ISR on every scheduler tick. A reading
+//!             counts one up or down; the debounced bit only changes once
+//!             its integrator hits 0 or DEBOUNCE_COUNT.
+void SensorsSample(void){
+    unsigned char raw = 0;
+    if (EXIST_SENSOR){
+        raw |= SENSOR_EXIST;
+    }
+    if (TYPE_SENSOR){
+        raw |= SENSOR_TYPE;
+    }
+    if (YOP_EDGE_SENSOR){
+        raw |= SENSOR_YOP_EDGE;
+    }
+    if (ESKA_EDGE_SENSOR){
+        raw |= SENSOR_ESKA_EDGE;
+    }
+    if (YOP_POST_SENSOR){
+        raw |= SENSOR_YOP_POST;
+    }
+    if (ESKA_POST_SENSOR){
+        raw |= SENSOR_ESKA_POST;
+    }
+    last = raw;
+
+    unsigned char bit = 1;
+    for (unsigned char i = 0; i < NUM_SENSORS; i++, bit <<= 1){
+        if (raw & bit){
+            if (level[i] < DEBOUNCE_COUNT){
+                level[i]++;
+            }
+            if (level[i] == DEBOUNCE_COUNT && !(stable & bit)){
+                stable |= bit;
+                rose |= bit;
+            }
+        } else {
+            if (level[i] > 0){
+                level[i]--;
+            }
+            if (level[i] == 0 && (stable & bit)){
+                stable &= ~bit;
+            }
+        }
+    }
+}
+
+//! @returns    The debounced sensor bits, see SENSOR_*.
+unsigned char Sensors(void){
+    return stable;
+}
+
+//! @brief      Reports and clears rising edges of the debounced inputs.
+//! @returns    The bits of mask that went to 1 since the last call.
+unsigned char SensorsRose(unsigned char mask){
+    di();
+    unsigned char r = rose & mask;
+    rose &= ~mask;
+    ei();
+    return r;
+}
+
+//! @returns    The sensor bits of the latest sample, not debounced.
+unsigned char SensorsRaw(void){
+    return last;
+}
@@ -0,0 +1,27 @@
+/*
+ * File:   sensors.h
+ */
+
+#ifndef SENSORS_H
+#define	SENSORS_H
+
+//Bits of the debounced sensor snapshot
+#define SENSOR_EXIST        0x01
+#define SENSOR_TYPE         0x02    //1 is Yop, 0 is Eska
+#define SENSOR_YOP_EDGE     0x04
+#define SENSOR_ESKA_EDGE    0x08
+#define SENSOR_YOP_POST     0x10
+#define SENSOR_ESKA_POST    0x20
+#define NUM_SENSORS         6
+
+//An input has to move this many 1 ms samples net towards a new level
+//before the debounced value follows
+#define DEBOUNCE_COUNT      40
+
+void SensorsInit(void);
+void SensorsSample(void);
+unsigned char Sensors(void);
+unsigned char SensorsRose(unsigned char mask);
+unsigned char SensorsRaw(void);
+
+#endif	/* SENSORS_H */
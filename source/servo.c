@@ -0,0 +1,99 @@
+/*
+ * File:   servo.c
+ */
+
+#include <xc.h>
+#include "configBits.h"
+#include "constants.h"
+#include "servo.h"
+
+//Pulse width in us for bins 1 to 4
+const unsigned int bin_width[5] = {0, 800, 1450, 1770, 2400};
+
+static volatile unsigned int width;     //0 while off
+static volatile unsigned char settle_frames;
+static unsigned int last_width;
+static bool high;
+
+static void SetPeriod(unsigned int us){
+    unsigned int reload = 65536 - us;
+    TMR3H = reload >> 8;
+    TMR3L = reload & 0xFF;
+}
+
+void BinServoInit(void){
+    T3CON = 0b10110000;     //16 bit writes, prescaler 1:8 for 1 us counts, off
+    BIN_SERVO = 0;
+    TMR3IF = 0;
+    TMR3IE = 1;
+    PEIE = 1;
+}
+
+static void SetWidth(unsigned int w){
+    //From an unknown position allow for the full travel
+    unsigned int travel = bin_width[4] - bin_width[1];
+    if (last_width){
+        travel = w > last_width ? w - last_width : last_width - w;
+    }
+    unsigned int settle_ms = travel / SERVO_US_PER_MS + SERVO_SETTLE_MS;
+
+    TMR3IE = 0;
+    width = w;
+    settle_frames = settle_ms / (SERVO_FRAME_US / 1000) + 1;
+    TMR3IE = 1;
+    last_width = w;
+
+    if (!TMR3ON){
+        high = 0;
+        SetPeriod(100);
+        TMR3IF = 0;
+        TMR3ON = 1;
+    }
+}
+
+//! @brief      Starts turning the servo towards a bin (1 to 4) and returns.
+//!             BinServoSettled() turns true once it has had time to get there.
+void BinServoSetTarget(char bin){
+    if (bin < 1 || bin > 4){
+        return;
+    }
+    SetWidth(bin_width[bin]);
+}
+
+//! @brief      Parks the servo halfway between two bins while it is not yet
+//!             known which of them the bottle goes to.
+void BinServoTowards(char bin_a, char bin_b){
+    if (bin_a < 1 || bin_a > 4 || bin_b < 1 || bin_b > 4){
+        return;
+    }
+    SetWidth((bin_width[bin_a] + bin_width[bin_b]) / 2);
+}
+
+//! @brief      Stops the pulses, the servo is left where it is.
+void BinServoOff(void){
+    TMR3ON = 0;
+    TMR3IF = 0;
+    BIN_SERVO = 0;
+    width = 0;
+    settle_frames = 0;
+}
+
+bool BinServoSettled(void){
+    return width && !settle_frames;
+}
+
+//! @brief      Starts or ends a pulse, called from the ISR on TMR3IF.
+void BinServoISR(void){
+    if (!high){
+        BIN_SERVO = 1;
+        high = 1;
+        SetPeriod(width);
+    } else {
+        BIN_SERVO = 0;
+        high = 0;
+        SetPeriod(SERVO_FRAME_US - width);
+        if (settle_frames){
+            settle_frames--;
+        }
+    }
+}
@@ -0,0 +1,19 @@
+/*
+ * File:   servo.h
+ */
+
+#ifndef SERVO_H
+#define	SERVO_H
+
+#define SERVO_FRAME_US      20000
+#define SERVO_US_PER_MS     3       //slew of the bin servo, ~0.2 s per 60 deg
+#define SERVO_SETTLE_MS     100     //margin on top of the slew time
+
+void BinServoInit(void);
+void BinServoSetTarget(char bin);
+void BinServoTowards(char bin_a, char bin_b);
+void BinServoOff(void);
+bool BinServoSettled(void);
+void BinServoISR(void);
+
+#endif	/* SERVO_H */
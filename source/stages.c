@@ -0,0 +1,51 @@
+/*
+ * File:   stages.c
+ */
+
+#include <xc.h>
+#include "scheduler.h"
+#include "stages.h"
+
+//Per stage totals over the current run, in ms
+unsigned long stage_total[NUM_STAGES];
+unsigned char stage_count[NUM_STAGES];
+
+static unsigned long stage_start[NUM_STAGES];
+static unsigned int stage_open;     //one bit per stage
+
+void StagesReset(void){
+    for (unsigned char i = 0; i < NUM_STAGES; i++){
+        stage_total[i] = 0;
+        stage_count[i] = 0;
+    }
+    stage_open = 0;
+}
+
+//! @brief      Marks the start of a stage. A stage that is already running
+//!             keeps its first start time.
+void StageBegin(unsigned char s){
+    unsigned int bit = 1 << s;
+    if (!(stage_open & bit)){
+        stage_start[s] = SchedMillis();
+        stage_open |= bit;
+    }
+}
+
+//! @brief      Marks the end of a stage and adds its duration to the run
+//!             totals. Does nothing if the stage was not started.
+void StageEnd(unsigned char s){
+    unsigned int bit = 1 << s;
+    if (stage_open & bit){
+        stage_total[s] += SchedMillis() - stage_start[s];
+        stage_count[s]++;
+        stage_open &= ~bit;
+    }
+}
+
+//! @returns    Mean duration of a stage over the run so far, in ms.
+unsigned int StageMean(unsigned char s){
+    if (!stage_count[s]){
+        return 0;
+    }
+    return stage_total[s] / stage_count[s];
+}
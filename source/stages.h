@@ -0,0 +1,25 @@
+/*
+ * File:   stages.h
+ */
+
+#ifndef STAGES_H
+#define	STAGES_H
+
+//Stages of one sort cycle. In a pipelined run they overlap.
+#define STAGE_TYPE          0   //bottle seen until its type is read
+#define STAGE_EDGE          1   //edge sensor on until it is read
+#define STAGE_TO_POST       2   //move down to the post sensors
+#define STAGE_POST          3   //settle and read the post sensor
+#define STAGE_TO_BOTTOM     4   //move down to the bottom
+#define STAGE_SERVO         5   //first servo command until it has settled
+#define STAGE_TIP           6   //slow rise that lets the bottle go
+#define STAGE_RETURN        7   //back up to the home switch
+#define STAGE_FEED          8   //feeding until the next bottle is seen
+#define NUM_STAGES          9
+
+void StagesReset(void);
+void StageBegin(unsigned char s);
+void StageEnd(unsigned char s);
+unsigned int StageMean(unsigned char s);
+
+#endif	/* STAGES_H */
@@ -0,0 +1,270 @@
+/*
+ * File:   stepper.c
+ */
+
+#include <xc.h>
+#include "configBits.h"
+#include "constants.h"
+#include "stepper.h"
+
+//Half step patterns, stepping forward through the table raises the carriage
+const char CW[8] = {0x08,0x0c,0x04,0x06,0x02,0x03,0x01,0x09};
+
+//Step period in us for each step of a ramp, 1e6 / sqrt(v0^2 + 2*a*n) with
+//v0 = 1000 half steps/s and a = 15000 half steps/s^2, up to 2500 half steps/s
+#define RAMP_STEPS 176
+const unsigned int ramp[RAMP_STEPS] = {
+    1000,985,971,958,945,933,921,909,898,887,877,867,
+    857,848,839,830,822,814,806,798,791,783,776,769,
+    762,756,750,743,737,731,725,720,714,709,704,698,
+    693,688,684,679,674,670,665,661,657,652,648,644,
+    640,636,632,629,625,621,618,614,611,607,604,601,
+    598,594,591,588,585,582,579,576,574,571,568,565,
+    563,560,557,555,552,550,547,545,542,540,538,535,
+    533,531,529,526,524,522,520,518,516,514,512,510,
+    508,506,504,502,500,498,496,494,493,491,489,487,
+    486,484,482,481,479,477,476,474,472,471,469,468,
+    466,465,463,462,460,459,457,456,455,453,452,450,
+    449,448,446,445,444,442,441,440,439,437,436,435,
+    434,432,431,430,429,428,426,425,424,423,422,421,
+    420,418,417,416,415,414,413,412,411,410,409,408,
+    407,406,405,404,403,402,401,400,
+};
+
+#define MODE_RAMP   0
+#define MODE_CREEP  1
+#define MODE_HOME   2       //creep up until the switch closes
+#define MODE_BACKOFF 3      //down off the switch
+#define MODE_SEEK   4       //slowly back up to it
+#define MODE_RETRY  5       //pause after a stall
+
+static volatile int position = STEPPER_UNHOMED;
+static volatile int target;
+static volatile bool busy;
+static volatile bool fault;
+static unsigned char mode;
+static unsigned char phase;
+static unsigned char ramp_index;
+static unsigned int creep_us;
+static unsigned int home_steps;
+static unsigned int home_expect;    //half steps the phase should take
+static unsigned char home_tries;
+static unsigned char retries;
+static bool then_home;
+
+static void SetPeriod(unsigned int us){
+    unsigned int reload = 65536 - us;
+    TMR1H = reload >> 8;
+    TMR1L = reload & 0xFF;
+}
+
+static void Start(unsigned int first_us){
+    TMR1ON = 0;
+    busy = 1;
+    SetPeriod(first_us);
+    TMR1IF = 0;
+    TMR1ON = 1;
+}
+
+static void Stop(void){
+    TMR1ON = 0;
+    TMR1IF = 0;
+    INT0IE = 0;
+    busy = 0;
+}
+
+//Homing phases run on from the ISR with the timer still going
+static void HomePhase(unsigned char m, unsigned int expect, unsigned int period_us){
+    mode = m;
+    home_steps = 0;
+    home_expect = expect + STEPPER_STALL_MARGIN;
+    SetPeriod(period_us);
+}
+
+//The phase went on too long: the carriage is stuck or lost steps
+static void HomeStall(void){
+    if (home_tries++ == STEPPER_HOME_RETRIES){
+        fault = 1;
+        Stop();
+        return;
+    }
+    retries++;
+    mode = MODE_RETRY;
+    SetPeriod(STEPPER_RETRY_US);
+}
+
+void StepperInit(void){
+    T1CON = 0b10110000;     //16 bit writes, prescaler 1:8 for 1 us counts, off
+    TMR1IF = 0;
+    TMR1IE = 1;
+    PEIE = 1;
+
+    INTCON2bits.INTEDG0 = 0;    //The home switch pulls RB0 low
+    INT0IE = 0;
+    retries = 0;
+}
+
+//! @brief      Moves to an absolute position, accelerating and decelerating
+//!             along the ramp table. Returns at once; poll StepperBusy().
+void StepperMoveTo(int t){
+    if (position == STEPPER_UNHOMED || t == position){
+        return;
+    }
+    Stop();
+    then_home = 0;
+    target = t;
+    mode = MODE_RAMP;
+    ramp_index = 0;
+    Start(ramp[0]);
+}
+
+//! @brief      Moves to an absolute position at a constant, slow speed.
+void StepperCreepTo(int t, unsigned int period_us){
+    if (position == STEPPER_UNHOMED || t == position){
+        return;
+    }
+    Stop();
+    then_home = 0;
+    target = t;
+    mode = MODE_CREEP;
+    creep_us = period_us;
+    Start(period_us);
+}
+
+//! @brief      Finds the home switch, which is position 0. From a known
+//!             position the carriage ramps up to STEPPER_APPROACH first and
+//!             creeps the rest, then backs off and comes back at
+//!             STEPPER_SEEK_US. A phase that overruns is retried, see
+//!             STEPPER_STALL_MARGIN; the fault flag is only set once the
+//!             retries are used up.
+void StepperHome(void){
+    Stop();
+    fault = 0;
+    home_tries = 0;
+    creep_us = STEPPER_CREEP_US;
+    INT0IF = 0;
+    INT0IE = 1;
+    busy = 1;
+    if (HOME_SWITCH == 0){
+        then_home = 0;
+        HomePhase(MODE_BACKOFF, STEPPER_BACKOFF, STEPPER_CREEP_US);
+    }
+    else if (position > STEPPER_APPROACH){
+        target = STEPPER_APPROACH;
+        mode = MODE_RAMP;
+        ramp_index = 0;
+        then_home = 1;
+        SetPeriod(ramp[0]);
+    }
+    else {
+        then_home = 0;
+        HomePhase(MODE_HOME, position == STEPPER_UNHOMED ? STEPPER_HOME_MAX : position,
+                  STEPPER_CREEP_US);
+    }
+    TMR1IF = 0;
+    TMR1ON = 1;
+}
+
+//! @brief      De-energises the coils. The position is lost until the next
+//!             StepperHome().
+void StepperRelease(void){
+    Stop();
+    STEPPER_PORT &= ~STEPPER_MASK;
+    position = STEPPER_UNHOMED;
+}
+
+bool StepperBusy(void){
+    return busy;
+}
+
+bool StepperFault(void){
+    return fault;
+}
+
+//! @returns    Homing retries since StepperInit().
+unsigned char StepperRetries(void){
+    return retries;
+}
+
+//! @brief      Stops homing on the step that closed the switch, called
+//!             from the ISR on INT0IF.
+void StepperSwitchISR(void){
+    INT0IF = 0;
+    if (mode == MODE_SEEK){
+        position = STEPPER_TOP;
+        Stop();
+    }
+    else if (mode == MODE_HOME || (mode == MODE_RAMP && then_home)){
+        //Fast, or sooner than expected: come back to it slowly
+        then_home = 0;
+        HomePhase(MODE_BACKOFF, STEPPER_BACKOFF, creep_us);
+    }
+}
+
+//! @brief      Takes one half step and sets up the timer for the next,
+//!             called from the ISR on TMR1IF.
+void StepperISR(void){
+    if (mode == MODE_RETRY){
+        //Where the carriage is is anyone's guess now
+        if (HOME_SWITCH == 0){
+            HomePhase(MODE_BACKOFF, STEPPER_BACKOFF, creep_us);
+        } else {
+            HomePhase(MODE_HOME, STEPPER_HOME_MAX, creep_us);
+        }
+        return;
+    }
+    if (mode >= MODE_HOME){
+        if (++home_steps > home_expect){
+            HomeStall();
+            return;
+        }
+        if (mode == MODE_BACKOFF){
+            //Off the switch and far enough below it
+            if (HOME_SWITCH != 0 && home_steps > STEPPER_BACKOFF){
+                HomePhase(MODE_SEEK, STEPPER_BACKOFF, STEPPER_SEEK_US);
+                return;
+            }
+            phase = (phase + 7) & 7;
+        } else {
+            phase = (phase + 1) & 7;
+        }
+        STEPPER_PORT = (STEPPER_PORT & ~STEPPER_MASK) | CW[phase];
+        SetPeriod(mode == MODE_SEEK ? STEPPER_SEEK_US : creep_us);
+        return;
+    }
+
+    if (target < position){
+        phase = (phase + 1) & 7;
+        position--;
+    } else {
+        phase = (phase + 7) & 7;
+        position++;
+    }
+    STEPPER_PORT = (STEPPER_PORT & ~STEPPER_MASK) | CW[phase];
+
+    int remaining = target - position;
+    if (remaining < 0){
+        remaining = -remaining;
+    }
+    if (remaining == 0){
+        if (then_home){
+            then_home = 0;
+            HomePhase(MODE_HOME, STEPPER_APPROACH, creep_us);
+            return;
+        }
+        Stop();
+        return;
+    }
+    if (mode == MODE_CREEP){
+        SetPeriod(creep_us);
+        return;
+    }
+
+    //Decelerate once the remaining steps are only enough to ramp down
+    if (remaining <= ramp_index){
+        ramp_index--;
+    } else if (ramp_index < RAMP_STEPS - 1){
+        ramp_index++;
+    }
+    SetPeriod(ramp[ramp_index]);
+}
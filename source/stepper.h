@@ -0,0 +1,42 @@
+/*
+ * File:   stepper.h
+ */
+
+#ifndef STEPPER_H
+#define	STEPPER_H
+
+//Carriage positions in half steps below the home switch
+#define STEPPER_UNHOMED     -1
+#define STEPPER_TOP         0       //existence, type and edge sensors
+#define STEPPER_POST        360     //post sensors
+#define STEPPER_BOTTOM      680     //bottle tips towards the bins
+#define STEPPER_TIPPED      600     //end of the slow rise that lets it go
+#define STEPPER_APPROACH    16      //homing moves fast up to here, then creeps
+
+//Homing: creep up to the switch, back off and find it again slowly. The
+//switch is INT0 on RB0, so the motor stops on the step that closes it.
+#define STEPPER_CREEP_US    1000    //homing speed, slow enough to stop dead
+#define STEPPER_SEEK_US     2000    //second, slower approach
+#define STEPPER_BACKOFF     4       //half steps down off the switch
+#define STEPPER_HOME_MAX    2400    //half steps to find the switch from anywhere
+
+//A homing phase that takes STEPPER_STALL_MARGIN more half steps than the
+//position says it should has stalled or lost steps. It is tried again from
+//an unknown position after STEPPER_RETRY_US, up to STEPPER_HOME_RETRIES
+//times before the fault flag is set.
+#define STEPPER_STALL_MARGIN 32
+#define STEPPER_RETRY_US    50000
+#define STEPPER_HOME_RETRIES 3
+
+void StepperInit(void);
+void StepperMoveTo(int target);
+void StepperCreepTo(int target, unsigned int period_us);
+void StepperHome(void);
+void StepperRelease(void);
+bool StepperBusy(void);
+bool StepperFault(void);
+unsigned char StepperRetries(void);
+void StepperISR(void);
+void StepperSwitchISR(void);
+
+#endif	/* STEPPER_H */
@@ -0,0 +1,89 @@
+/*
+ * File:   uart.c
+ */
+
+#include <xc.h>
+#include "configBits.h"
+#include "uart.h"
+
+//EUSART on RC6 (TX) and RC7 (RX). The ISR moves bytes between the
+//hardware and two rings; each ring has one writer for head and one for
+//tail, so neither side has to mask the other.
+#define BRG                 (_XTAL_FREQ / (4 * UART_BAUD) - 1)     //BRG16 and BRGH set
+
+static volatile unsigned char tx_buf[UART_TX_LEN];
+static volatile unsigned char tx_head, tx_tail;
+static volatile unsigned char rx_buf[UART_RX_LEN];
+static volatile unsigned char rx_head, rx_tail;
+
+void UartInit(void){
+    tx_head = tx_tail = 0;
+    rx_head = rx_tail = 0;
+
+    TRISCbits.TRISC6 = 1;       //Both pins are handed to the EUSART
+    TRISCbits.TRISC7 = 1;
+    BAUDCONbits.BRG16 = 1;
+    TXSTAbits.BRGH = 1;
+    TXSTAbits.SYNC = 0;
+    SPBRGH = BRG >> 8;
+    SPBRG = BRG & 0xFF;
+    RCSTAbits.SPEN = 1;
+    RCSTAbits.CREN = 1;
+    TXSTAbits.TXEN = 1;
+    PIE1bits.RCIE = 1;
+    PEIE = 1;
+}
+
+//! @brief      Queues a byte for sending.
+//! @returns    false if the transmit ring is full.
+bool UartPut(unsigned char c){
+    unsigned char next = (tx_head + 1) & (UART_TX_LEN - 1);
+    if (next == tx_tail){
+        return false;
+    }
+    tx_buf[tx_head] = c;
+    tx_head = next;
+    PIE1bits.TXIE = 1;
+    return true;
+}
+
+//! @returns    Bytes that UartPut() can take without failing.
+unsigned char UartFree(void){
+    return (tx_tail - tx_head - 1) & (UART_TX_LEN - 1);
+}
+
+//! @brief      Takes the oldest received byte.
+//! @returns    false if nothing has arrived.
+bool UartGet(unsigned char *c){
+    if (rx_head == rx_tail){
+        return false;
+    }
+    *c = rx_buf[rx_tail];
+    rx_tail = (rx_tail + 1) & (UART_RX_LEN - 1);
+    return true;
+}
+
+//! @brief      Called from the ISR on RCIF, or TXIF while TXIE is set.
+void UartISR(void){
+    while (PIR1bits.RCIF){
+        unsigned char c = RCREG;
+        unsigned char next = (rx_head + 1) & (UART_RX_LEN - 1);
+        if (next != rx_tail){
+            rx_buf[rx_head] = c;
+            rx_head = next;
+        }
+    }
+    if (RCSTAbits.OERR){
+        //A byte was lost in the hardware; receiving stops until CREN is cycled
+        RCSTAbits.CREN = 0;
+        RCSTAbits.CREN = 1;
+    }
+    if (PIE1bits.TXIE && PIR1bits.TXIF){
+        if (tx_head != tx_tail){
+            TXREG = tx_buf[tx_tail];
+            tx_tail = (tx_tail + 1) & (UART_TX_LEN - 1);
+        } else {
+            PIE1bits.TXIE = 0;
+        }
+    }
+}
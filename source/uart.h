@@ -0,0 +1,23 @@
+/*
+ * File:   uart.h
+ */
+
+#ifndef UART_H
+#define	UART_H
+
+#include <stdbool.h>
+
+#ifndef UART_BAUD
+#define UART_BAUD           115200UL
+#endif
+
+#define UART_TX_LEN         64      //Ring sizes, powers of two
+#define UART_RX_LEN         32
+
+void UartInit(void);
+bool UartPut(unsigned char c);
+unsigned char UartFree(void);
+bool UartGet(unsigned char *c);
+void UartISR(void);
+
+#endif	/* UART_H */